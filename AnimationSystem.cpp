@@ -0,0 +1,174 @@
+#include "AnimationSystem.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+AnimationSystem::AnimationSystem(uint32_t threads) {
+	if (threads == 0) {
+		threads = std::max(1U, std::thread::hardware_concurrency()) - 1;
+	}
+	workers.reserve(threads);
+	for (uint32_t t = 0; t < threads; ++t) {
+		workers.emplace_back([this]() { work(); });
+	}
+}
+
+AnimationSystem::~AnimationSystem() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+AnimationSystem::Detail AnimationSystem::detail(glm::mat4 const &world_to_clip, glm::vec3 const &center, float radius) {
+	//rows of world_to_clip (as vec4s) give the frustum planes:
+	glm::vec4 row[4];
+	for (uint32_t r = 0; r < 4; ++r) {
+		row[r] = glm::vec4(world_to_clip[0][r], world_to_clip[1][r], world_to_clip[2][r], world_to_clip[3][r]);
+	}
+	glm::vec4 p = glm::vec4(center, 1.0f);
+
+	Detail ret;
+	//near plane and the four sides (the camera has an infinite far plane):
+	glm::vec4 planes[5] = { row[3] + row[2], row[3] + row[0], row[3] - row[0], row[3] + row[1], row[3] - row[1] };
+	for (auto const &plane : planes) {
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f && glm::dot(plane, p) < -radius * length) {
+			ret.visible = false;
+			ret.screen_size = 0.0f;
+			return ret;
+		}
+	}
+
+	//the y row's xyz is (proj[1][1] * camera y axis), so its length is the projection's vertical scale:
+	float w = glm::dot(row[3], p);
+	float scale = glm::length(glm::vec3(row[1]));
+	ret.screen_size = (w > radius ? radius * scale / w : 1.0f);
+	return ret;
+}
+
+uint32_t AnimationSystem::add(BoneAnimationPlayer *player) {
+	return add(player, Detail());
+}
+
+uint32_t AnimationSystem::add(BoneAnimationMixer *mixer) {
+	return add(mixer, Detail());
+}
+
+uint32_t AnimationSystem::add(BoneAnimationPlayer *player, Detail const &detail) {
+	assert(player);
+	jobs.emplace_back();
+	jobs.back().player = player;
+	jobs.back().detail = detail;
+	return uint32_t(jobs.size() - 1);
+}
+
+uint32_t AnimationSystem::add(BoneAnimationMixer *mixer, Detail const &detail) {
+	assert(mixer);
+	jobs.emplace_back();
+	jobs.back().mixer = mixer;
+	jobs.back().detail = detail;
+	return uint32_t(jobs.size() - 1);
+}
+
+void AnimationSystem::run_jobs() {
+	uint32_t count = uint32_t(run.size());
+	while (true) {
+		uint32_t r = next_job.fetch_add(1);
+		if (r >= count) break;
+		Job &job = jobs[run[r]];
+		uint32_t depth_limit = (job.detail.screen_size < ReducedBonesSize ? ReducedBoneDepth : -1U);
+		if (job.player) {
+			job.player->depth_limit = depth_limit;
+			job.player->evaluate();
+		} else {
+			job.mixer->depth_limit = depth_limit;
+			job.mixer->evaluate();
+		}
+		finished.fetch_add(1);
+	}
+}
+
+void AnimationSystem::work() {
+	uint32_t seen = 0;
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		wake.wait(lock, [&]() { return quit || generation != seen; });
+		if (quit) return;
+		seen = generation;
+		if (!open) continue; //woke too late; that batch is already over
+
+		++busy;
+		lock.unlock();
+		run_jobs();
+		lock.lock();
+		--busy;
+		done.notify_one();
+	}
+}
+
+void AnimationSystem::evaluate(BonePalette *palette_) {
+	assert(palette_);
+	auto &palette = *palette_;
+
+	//pick which jobs get evaluated this frame:
+	++frame;
+	counters = Counters();
+	run.clear();
+	for (uint32_t j = 0; j < jobs.size(); ++j) {
+		Detail const &detail = jobs[j].detail;
+		//a job that was never evaluated has no last matrices to hand on, so it can't be skipped:
+		bool fresh = (jobs[j].player ? jobs[j].player->banims.baked.empty() && jobs[j].player->evaluated_position < 0.0f : jobs[j].mixer->bone_matrices.empty());
+		if (fresh) {
+			++counters.evaluated;
+			if (detail.screen_size < ReducedBonesSize) ++counters.reduced;
+			run.emplace_back(j);
+			continue;
+		}
+		if (!detail.visible) {
+			++counters.culled;
+			continue;
+		}
+		uint32_t interval = (detail.screen_size >= FullDetailSize ? 1 : detail.screen_size >= HalfRateSize ? 2 : 4);
+		//(stagger by address, so that throttled jobs spread over frames)
+		uintptr_t id = reinterpret_cast< uintptr_t >(jobs[j].player ? (void *)jobs[j].player : (void *)jobs[j].mixer);
+		if ((frame + uint32_t(id >> 4)) % interval != 0) {
+			++counters.throttled;
+			continue;
+		}
+		++counters.evaluated;
+		if (detail.screen_size < ReducedBonesSize) ++counters.reduced;
+		run.emplace_back(j);
+	}
+
+	next_job = 0;
+	finished = 0;
+	if (run.size() > 1 && !workers.empty()) {
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			open = true;
+			++generation;
+		}
+		wake.notify_all();
+
+		run_jobs();
+
+		std::unique_lock< std::mutex > lock(mutex);
+		done.wait(lock, [&]() { return finished == run.size() && busy == 0; });
+		open = false;
+	} else {
+		run_jobs(); //not worth waking anyone
+	}
+
+	//hand the results to the renderer:
+	offsets.clear();
+	for (auto const &job : jobs) {
+		if (job.player) offsets.emplace_back(palette.append(job.player->matrices(), (uint32_t) job.player->bone_matrices.size()));
+		else offsets.emplace_back(palette.append(job.mixer->matrices(), (uint32_t) job.mixer->bone_matrices.size()));
+	}
+	jobs.clear();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+/*
+ * An "AnimationSystem" evaluates every animated skeleton for a frame in parallel:
+ * queue players and mixers with add(), then evaluate() spreads them over a pool
+ * of worker threads (the calling thread helps too) and appends the finished
+ * bone matrices to a BonePalette for drawing.
+ *
+ * Jobs must not share state: don't add a player that is also a layer of an
+ * added mixer, and don't share a player between two added mixers.
+ *
+ * Level of detail: each job may come with a Detail (see detail()) saying
+ * whether it is on screen and how big it looks. Off-screen jobs are frozen,
+ * small ones are evaluated every few frames (staggered so they don't all
+ * land on the same frame), and tiny ones with a reduced bone set.
+ * Skipped jobs keep (and hand to the palette) their last matrices; jobs that
+ * have never been evaluated have none, so they are evaluated regardless.
+ */
+
+#include "BoneAnimation.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct AnimationSystem {
+	//start 'threads' workers (0 == one fewer than the number of hardware threads):
+	AnimationSystem(uint32_t threads = 0);
+	~AnimationSystem();
+	AnimationSystem(AnimationSystem const &) = delete;
+
+	//how a job looks from the camera:
+	struct Detail {
+		bool visible = true;
+		float screen_size = 1.0f; //projected diameter as a fraction of the viewport height
+	};
+
+	//detail for a bounding sphere seen through 'world_to_clip':
+	static Detail detail(glm::mat4 const &world_to_clip, glm::vec3 const &center, float radius);
+
+	//level-of-detail policy:
+	static constexpr float FullDetailSize = 0.15f; //at least this big: evaluate every frame
+	static constexpr float HalfRateSize = 0.05f; //at least this big: every other frame; smaller: every fourth
+	static constexpr float ReducedBonesSize = 0.05f; //smaller than this: only bones up to ReducedBoneDepth
+	static constexpr uint32_t ReducedBoneDepth = 3;
+
+	//queue work for the next evaluate(); returns the job's index into 'offsets':
+	// (without a Detail, the job is evaluated every frame at full detail)
+	uint32_t add(BoneAnimationPlayer *player);
+	uint32_t add(BoneAnimationMixer *mixer);
+	uint32_t add(BoneAnimationPlayer *player, Detail const &detail);
+	uint32_t add(BoneAnimationMixer *mixer, Detail const &detail);
+
+	//evaluate all queued jobs, append their matrices to *palette (in add() order),
+	// record where each landed in 'offsets', and empty the queue:
+	void evaluate(BonePalette *palette);
+
+	//palette offset of each job of the last evaluate():
+	std::vector< uint32_t > offsets;
+
+	//what the last evaluate() did with its jobs:
+	struct Counters {
+		uint32_t evaluated = 0; //jobs evaluated (at full or reduced detail)
+		uint32_t reduced = 0; //...of which with a reduced bone set
+		uint32_t throttled = 0; //jobs skipped because it wasn't their frame
+		uint32_t culled = 0; //jobs skipped because they were off screen
+	} counters;
+
+	//-- internals ---
+	struct Job {
+		BoneAnimationPlayer *player = nullptr;
+		BoneAnimationMixer *mixer = nullptr;
+		Detail detail;
+	};
+	std::vector< Job > jobs;
+	std::vector< uint32_t > run; //indices of the jobs actually being evaluated this frame
+	uint32_t frame = 0; //evaluate() count, for staggering throttled jobs
+
+	std::vector< std::thread > workers;
+	std::mutex mutex;
+	std::condition_variable wake; //workers wait on this for a new batch (or quit)
+	std::condition_variable done; //evaluate() waits on this for the batch to finish
+	uint32_t generation = 0; //bumped for each batch (guarded by mutex)
+	bool open = false; //is a batch currently running? (guarded by mutex)
+	uint32_t busy = 0; //workers inside run_jobs() (guarded by mutex)
+	bool quit = false; //(guarded by mutex)
+	std::atomic< uint32_t > next_job{0};
+	std::atomic< uint32_t > finished{0};
+
+	void run_jobs(); //claim and run jobs until none are left
+	void work(); //worker thread body
+};
@@ -3,10 +3,15 @@
 #include "read_write_chunk.hpp"
 #include "gl_errors.hpp"
 
-#include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <set>
 #include <fstream>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BONE_ANIMATION_USE_SSE 1
+#include <xmmintrin.h>
+#endif
 
 BoneAnimation::BoneAnimation(std::string const& filename) {
 	std::cout << "Reading bone-based animation from '" << filename << "'." << std::endl;
@@ -39,16 +44,18 @@ BoneAnimation::BoneAnimation(std::string const& filename) {
 			bone.name = std::string(&strings[0] + file_bone.name_begin, &strings[0] + file_bone.name_end);
 			bone.parent = file_bone.parent;
 			bone.inverse_bind_matrix = file_bone.inverse_bind_matrix;
+			bone.depth = (bone.parent == -1U ? 0 : bones[bone.parent].depth + 1);
 		}
 	}
 
 	static_assert(sizeof(PoseBone) == 3 * 4 + 4 * 4 + 3 * 4, "PoseBone is packed.");
+	std::vector< PoseBone > frame_bones;
 	read_chunk(file, "frm0", &frame_bones);
 	if (frame_bones.size() % bones.size() != 0) {
 		throw std::runtime_error("frame bones is not divisible by bones");
 	}
 
-	uint32_t frames = (uint32_t) frame_bones.size() / (uint32_t) bones.size();
+	frames = (uint32_t) frame_bones.size() / (uint32_t) bones.size();
 
 	{ //read actions (animations):
 		struct AnimationInfo {
@@ -75,6 +82,9 @@ BoneAnimation::BoneAnimation(std::string const& filename) {
 		}
 	}
 
+	compress_poses(frame_bones);
+	std::cout << "INFO: compressed " << frames << " frames of " << bones.size() << " bones in '" << filename << "' from " << frame_bones.size() * sizeof(PoseBone) << " to " << tracks.size() * sizeof(Track) + keys.size() * sizeof(Key) << " bytes." << std::endl;
+
 	{ //read actual mesh:
 		struct Vertex {
 			glm::vec3 Position;
@@ -196,8 +206,541 @@ GLuint BoneAnimation::make_vao_for_program(GLuint program) const {
 	return vao;
 }
 
+//------------ pose compression ------------
+
+namespace {
+	//channel values are handled as vec4s (xyz for positions/scales, xyzw for rotations):
+	glm::vec4 channel_value(BoneAnimation::PoseBone const& pose_bone, uint32_t channel) {
+		if (channel == BoneAnimation::PositionChannel) return glm::vec4(pose_bone.position, 0.0f);
+		if (channel == BoneAnimation::RotationChannel) return glm::vec4(pose_bone.rotation.x, pose_bone.rotation.y, pose_bone.rotation.z, pose_bone.rotation.w);
+		return glm::vec4(pose_bone.scale, 0.0f);
+	}
+
+	//distance between two values, in the units of the channel's tolerance:
+	float channel_error(uint32_t channel, glm::vec4 const& a, glm::vec4 const& b) {
+		if (channel == BoneAnimation::RotationChannel) {
+			glm::vec4 d = (glm::dot(a, b) < 0.0f ? a + b : a - b);
+			return 2.0f * glm::length(d); //~angle between the rotations (for small angles)
+		}
+		glm::vec3 d = glm::abs(glm::vec3(a) - glm::vec3(b));
+		return std::max(d.x, std::max(d.y, d.z));
+	}
+
+	float channel_tolerance(uint32_t channel) {
+		if (channel == BoneAnimation::PositionChannel) return BoneAnimation::PositionTolerance;
+		if (channel == BoneAnimation::RotationChannel) return BoneAnimation::RotationTolerance;
+		return BoneAnimation::ScaleTolerance;
+	}
+
+	//interpolate between two keys (nlerp in the shorter direction for rotations):
+	glm::vec4 channel_mix(uint32_t channel, glm::vec4 const& a, glm::vec4 const& b, float t) {
+		if (channel == BoneAnimation::RotationChannel) {
+			glm::vec4 q = a * (1.0f - t) + (glm::dot(a, b) < 0.0f ? -b : b) * t;
+			return q * (1.0f / std::sqrt(glm::dot(q, q)));
+		}
+		return a + (b - a) * t;
+	}
+
+	//"smallest three" rotation quantization: drop the largest component (made positive,
+	// so recoverable as sqrt(1 - others^2)) and store the other three in 15 bits each;
+	// the dropped component's index goes in the top bits of data[0] and data[1]:
+	const float SmallestThreeRange = 0.70710678f; //other components are within +/- 1/sqrt(2)
+
+	void encode_rotation(glm::vec4 q, uint16_t data[3]) {
+		q *= 1.0f / std::sqrt(glm::dot(q, q));
+		uint32_t largest = 0;
+		for (uint32_t i = 1; i < 4; ++i) {
+			if (std::abs(q[i]) > std::abs(q[largest])) largest = i;
+		}
+		if (q[largest] < 0.0f) q = -q;
+		for (uint32_t i = 0, o = 0; i < 4; ++i) {
+			if (i == largest) continue;
+			float amt = (q[i] / SmallestThreeRange) * 0.5f + 0.5f;
+			data[o++] = (uint16_t) std::round(std::max(0.0f, std::min(amt, 1.0f)) * 32767.0f);
+		}
+		data[0] |= uint16_t((largest & 1) << 15);
+		data[1] |= uint16_t((largest >> 1) << 15);
+	}
+
+	glm::vec4 decode_rotation(uint16_t const data[3]) {
+		uint32_t largest = (data[0] >> 15) | ((data[1] >> 15) << 1);
+		glm::vec4 q;
+		float sum2 = 0.0f;
+		for (uint32_t i = 0, o = 0; i < 4; ++i) {
+			if (i == largest) continue;
+			q[i] = ((data[o++] & 0x7fff) / 32767.0f * 2.0f - 1.0f) * SmallestThreeRange;
+			sum2 += q[i] * q[i];
+		}
+		q[largest] = std::sqrt(std::max(0.0f, 1.0f - sum2));
+		return q;
+	}
+
+	glm::vec4 decode_key(uint32_t channel, BoneAnimation::Track const& track, BoneAnimation::Key const& key) {
+		if (channel == BoneAnimation::RotationChannel) return decode_rotation(key.data);
+		return glm::vec4(
+			track.base.x + key.data[0] * track.step.x,
+			track.base.y + key.data[1] * track.step.y,
+			track.base.z + key.data[2] * track.step.z,
+			0.0f
+		);
+	}
+
+	BoneAnimation::Key encode_key(uint32_t channel, BoneAnimation::Track const& track, uint32_t frame, glm::vec4 const& value) {
+		BoneAnimation::Key key;
+		key.frame = uint16_t(frame);
+		if (channel == BoneAnimation::RotationChannel) {
+			encode_rotation(value, key.data);
+		}
+		else {
+			for (uint32_t c = 0; c < 3; ++c) {
+				float q = (track.step[c] > 0.0f ? (value[c] - track.base[c]) / track.step[c] : 0.0f);
+				key.data[c] = (uint16_t) std::round(std::max(0.0f, std::min(q, 65535.0f)));
+			}
+		}
+		return key;
+	}
+}
+
+void BoneAnimation::compress_poses(std::vector< PoseBone > const& frame_bones) {
+	assert(frames == frame_bones.size() / bones.size());
+	if (frames > 0x10000) {
+		throw std::runtime_error("too many frames to compress");
+	}
+
+	//the first and last frames of each animation always stay keys (so keys never interpolate across animations):
+	std::vector< bool > boundary(frames, false);
+	for (auto const& animation : animations) {
+		if (animation.begin == animation.end) continue;
+		boundary[animation.begin] = true;
+		boundary[animation.end - 1] = true;
+	}
+
+	tracks.assign(bones.size() * Channels, Track());
+	keys.clear();
+
+	std::vector< glm::vec4 > values(frames);
+	for (uint32_t b = 0; b < bones.size(); ++b) {
+		for (uint32_t channel = 0; channel < Channels; ++channel) {
+			Track& track = tracks[b * Channels + channel];
+			float tolerance = channel_tolerance(channel);
+			for (uint32_t f = 0; f < frames; ++f) {
+				values[f] = channel_value(frame_bones[f * bones.size() + b], channel);
+			}
+			if (frames == 0) continue;
+
+			//constant track?
+			bool constant = true;
+			for (uint32_t f = 1; f < frames && constant; ++f) {
+				constant = (channel_error(channel, values[f], values[0]) <= tolerance);
+			}
+			if (constant) {
+				track.base = values[0];
+				if (channel == RotationChannel) track.base *= 1.0f / std::sqrt(glm::dot(track.base, track.base));
+				continue;
+			}
+
+			//quantization range:
+			if (channel != RotationChannel) {
+				glm::vec3 min = glm::vec3(values[0]);
+				glm::vec3 max = glm::vec3(values[0]);
+				for (auto const& v : values) {
+					min = glm::min(min, glm::vec3(v));
+					max = glm::max(max, glm::vec3(v));
+				}
+				track.base = glm::vec4(min, 0.0f);
+				track.step = (max - min) / 65535.0f;
+			}
+
+			//greedy key reduction: from each key, reach as far as interpolation stays within tolerance:
+			track.first_key = (uint32_t) keys.size();
+			keys.emplace_back(encode_key(channel, track, 0, values[0]));
+			uint32_t a = 0;
+			while (a + 1 < frames) {
+				glm::vec4 from = decode_key(channel, track, keys.back());
+				auto fits = [&](uint32_t to) {
+					glm::vec4 to_value = decode_key(channel, track, encode_key(channel, track, to, values[to]));
+					for (uint32_t f = a + 1; f < to; ++f) {
+						glm::vec4 v = channel_mix(channel, from, to_value, float(f - a) / float(to - a));
+						if (channel_error(channel, v, values[f]) > tolerance) return false;
+					}
+					return true;
+				};
+				uint32_t next = a + 1;
+				while (next + 1 < frames && !boundary[next] && fits(next + 1)) ++next;
+				keys.emplace_back(encode_key(channel, track, next, values[next]));
+				a = next;
+			}
+			track.key_count = (uint32_t) keys.size() - track.first_key;
+		}
+	}
+	keys.shrink_to_fit();
+}
+
+void BoneAnimation::sample_frame(float at, BonePose* out_, uint32_t depth_limit) const {
+	assert(out_);
+	auto& out = *out_;
+	assert(out.bones == bones.size());
+
+	for (uint32_t b = 0; b < bones.size(); ++b) {
+		if (bones[b].depth > depth_limit) continue;
+		for (uint32_t channel = 0; channel < Channels; ++channel) {
+			Track const& track = tracks[b * Channels + channel];
+			glm::vec4 value;
+			if (track.key_count == 0) {
+				value = track.base;
+			}
+			else {
+				Key const* first = &keys[track.first_key];
+				Key const* last = first + track.key_count;
+				Key const* next = std::upper_bound(first, last, at, [](float at, Key const& key) { return at < float(key.frame); });
+				if (next == first) {
+					value = decode_key(channel, track, *first);
+				}
+				else if (next == last) {
+					value = decode_key(channel, track, *(last - 1));
+				}
+				else {
+					Key const& prev = *(next - 1);
+					float t = (at - float(prev.frame)) / float(next->frame - prev.frame);
+					value = channel_mix(channel, decode_key(channel, track, prev), decode_key(channel, track, *next), t);
+				}
+			}
+
+			uint32_t c = (channel == PositionChannel ? BonePose::PX : channel == RotationChannel ? BonePose::RX : BonePose::SX);
+			out[c + 0][b] = value.x;
+			out[c + 1][b] = value.y;
+			out[c + 2][b] = value.z;
+			if (channel == RotationChannel) out[c + 3][b] = value.w;
+		}
+	}
+}
+
+//------------ pose sampling / blending ------------
+
+void BonePose::resize(uint32_t bones_) {
+	if (bones_ == bones && !data.empty()) return;
+	bones = bones_;
+	stride = (bones + 3) & ~3U;
+	//start every lane (including padding) as an identity transform:
+	data.assign(size_t(Components) * stride, 0.0f);
+	std::fill_n((*this)[RW], stride, 1.0f);
+	std::fill_n((*this)[SX], 3 * stride, 1.0f);
+}
+
+namespace {
+	//out = a + (b - a) * amt over 'count' floats ('count' a multiple of four):
+	void lerp_floats(float const* a, float const* b, float amt, uint32_t count, float* out) {
+#ifdef BONE_ANIMATION_USE_SSE
+		const __m128 t = _mm_set1_ps(amt);
+		for (uint32_t i = 0; i < count; i += 4) {
+			__m128 va = _mm_loadu_ps(a + i);
+			__m128 vb = _mm_loadu_ps(b + i);
+			_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), t)));
+		}
+#else
+		for (uint32_t i = 0; i < count; ++i) {
+			out[i] = a[i] + (b[i] - a[i]) * amt;
+		}
+#endif
+	}
+
+	//out += w * a over 'count' floats ('count' a multiple of four):
+	void add_scaled_floats(float const* a, float w, uint32_t count, float* out) {
+#ifdef BONE_ANIMATION_USE_SSE
+		const __m128 vw = _mm_set1_ps(w);
+		for (uint32_t i = 0; i < count; i += 4) {
+			_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(a + i), vw)));
+		}
+#else
+		for (uint32_t i = 0; i < count; ++i) {
+			out[i] += a[i] * w;
+		}
+#endif
+	}
+
+	//slerp the rotation components of two component blocks (each Components * stride floats).
+	// This is nlerp with the parameter nudged by a polynomial fit of slerp's timing curve
+	// (a function of the angle between the quaternions), so it needs no trig and stays
+	// within a small fraction of a degree of true slerp:
+	void slerp_rotations(float const* a, float const* b, float amt, uint32_t stride, float* out) {
+		float const* ax = a + BonePose::RX * stride; float const* bx = b + BonePose::RX * stride;
+		float const* ay = a + BonePose::RY * stride; float const* by = b + BonePose::RY * stride;
+		float const* az = a + BonePose::RZ * stride; float const* bz = b + BonePose::RZ * stride;
+		float const* aw = a + BonePose::RW * stride; float const* bw = b + BonePose::RW * stride;
+		float* ox = out + BonePose::RX * stride;
+		float* oy = out + BonePose::RY * stride;
+		float* oz = out + BonePose::RZ * stride;
+		float* ow = out + BonePose::RW * stride;
+
+		const float t = amt;
+		const float t2 = (t - 0.5f) * (t - 0.5f);
+		const float t3 = t * (t - 0.5f) * (t - 1.0f);
+
+#ifdef BONE_ANIMATION_USE_SSE
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 vt = _mm_set1_ps(t), vt2 = _mm_set1_ps(t2), vt3 = _mm_set1_ps(t3);
+		auto splat = [](float f) { return _mm_set1_ps(f); };
+		for (uint32_t i = 0; i < stride; i += 4) {
+			__m128 qax = _mm_loadu_ps(ax + i), qay = _mm_loadu_ps(ay + i), qaz = _mm_loadu_ps(az + i), qaw = _mm_loadu_ps(aw + i);
+			__m128 qbx = _mm_loadu_ps(bx + i), qby = _mm_loadu_ps(by + i), qbz = _mm_loadu_ps(bz + i), qbw = _mm_loadu_ps(bw + i);
+
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qax, qbx), _mm_mul_ps(qay, qby)), _mm_add_ps(_mm_mul_ps(qaz, qbz), _mm_mul_ps(qaw, qbw)));
+			__m128 d_sign = _mm_and_ps(d, sign); //take the short way around
+			d = _mm_andnot_ps(sign, d);
+
+			__m128 A = _mm_add_ps(splat(1.0904f), _mm_mul_ps(d, _mm_add_ps(splat(-3.2452f), _mm_mul_ps(d, _mm_sub_ps(splat(3.55645f), _mm_mul_ps(d, splat(1.43519f)))))));
+			__m128 B = _mm_add_ps(splat(0.848013f), _mm_mul_ps(d, _mm_add_ps(splat(-1.06021f), _mm_mul_ps(d, splat(0.215638f)))));
+			__m128 k = _mm_add_ps(_mm_mul_ps(A, vt2), B);
+			__m128 ot = _mm_add_ps(vt, _mm_mul_ps(vt3, k));
+
+			__m128 wa = _mm_sub_ps(one, ot);
+			__m128 wb = _mm_xor_ps(ot, d_sign);
+			__m128 x = _mm_add_ps(_mm_mul_ps(qax, wa), _mm_mul_ps(qbx, wb));
+			__m128 y = _mm_add_ps(_mm_mul_ps(qay, wa), _mm_mul_ps(qby, wb));
+			__m128 z = _mm_add_ps(_mm_mul_ps(qaz, wa), _mm_mul_ps(qbz, wb));
+			__m128 w = _mm_add_ps(_mm_mul_ps(qaw, wa), _mm_mul_ps(qbw, wb));
+
+			__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+			__m128 inv = _mm_div_ps(one, len);
+			_mm_storeu_ps(ox + i, _mm_mul_ps(x, inv));
+			_mm_storeu_ps(oy + i, _mm_mul_ps(y, inv));
+			_mm_storeu_ps(oz + i, _mm_mul_ps(z, inv));
+			_mm_storeu_ps(ow + i, _mm_mul_ps(w, inv));
+		}
+#else
+		for (uint32_t i = 0; i < stride; ++i) {
+			float d = ax[i] * bx[i] + ay[i] * by[i] + az[i] * bz[i] + aw[i] * bw[i];
+			float s = (d < 0.0f ? -1.0f : 1.0f); //take the short way around
+			d = std::abs(d);
+
+			float A = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+			float B = 0.848013f + d * (-1.06021f + d * 0.215638f);
+			float ot = t + t3 * (A * t2 + B);
+
+			float wa = 1.0f - ot;
+			float wb = ot * s;
+			float x = ax[i] * wa + bx[i] * wb;
+			float y = ay[i] * wa + by[i] * wb;
+			float z = az[i] * wa + bz[i] * wb;
+			float w = aw[i] * wa + bw[i] * wb;
+
+			float inv = 1.0f / std::sqrt(x * x + y * y + z * z + w * w);
+			ox[i] = x * inv;
+			oy[i] = y * inv;
+			oz[i] = z * inv;
+			ow[i] = w * inv;
+		}
+#endif
+	}
+
+	//out = a * (1 - amt) + b * amt for whole component blocks:
+	void interpolate_components(float const* a, float const* b, float amt, uint32_t stride, float* out) {
+		lerp_floats(a + BonePose::PX * stride, b + BonePose::PX * stride, amt, 3 * stride, out + BonePose::PX * stride);
+		slerp_rotations(a, b, amt, stride, out);
+		lerp_floats(a + BonePose::SX * stride, b + BonePose::SX * stride, amt, 3 * stride, out + BonePose::SX * stride);
+	}
+}
+
+void sample_pose(BoneAnimation const& banims, BoneAnimation::Animation const& anim, float position, BonePose* out_, uint32_t depth_limit) {
+	assert(out_);
+	auto& out = *out_;
+	assert(anim.begin < anim.end && "can't sample an empty animation");
+
+	out.resize((uint32_t) banims.bones.size());
+
+	float at = (anim.end - 1 - anim.begin) * position + anim.begin;
+	banims.sample_frame(std::max(std::min(at, float(anim.end - 1)), float(anim.begin)), &out, depth_limit);
+}
+
+void blend_poses(BonePose const& a, BonePose const& b, float amt, BonePose* out_) {
+	assert(out_);
+	auto& out = *out_;
+	assert(a.bones == b.bones && "can only blend poses of the same skeleton");
+
+	out.resize(a.bones);
+	interpolate_components(a.data.data(), b.data.data(), amt, out.stride, out.data.data());
+}
+
+void blend_poses(BonePose const* const* poses, float const* weights, uint32_t count, BonePose* out_) {
+	assert(out_);
+	auto& out = *out_;
+	assert(count > 0);
+
+	float total = 0.0f;
+	for (uint32_t i = 0; i < count; ++i) {
+		assert(poses[i] && poses[i] != out_ && poses[i]->bones == poses[0]->bones);
+		total += weights[i];
+	}
+	assert(total > 0.0f && "need some weight to blend");
+
+	out.resize(poses[0]->bones);
+	uint32_t stride = out.stride;
+	float* o = out.data.data();
+
+	//weighted sum, starting from the first pose:
+	{
+		float w = weights[0] / total;
+		float const* p = poses[0]->data.data();
+		for (uint32_t i = 0; i < out.data.size(); ++i) {
+			o[i] = p[i] * w;
+		}
+	}
+	for (uint32_t l = 1; l < count; ++l) {
+		float w = weights[l] / total;
+		float const* p = poses[l]->data.data();
+		add_scaled_floats(p + BonePose::PX * stride, w, 3 * stride, o + BonePose::PX * stride);
+		add_scaled_floats(p + BonePose::SX * stride, w, 3 * stride, o + BonePose::SX * stride);
+
+		//rotations get flipped into the same hemisphere as the running sum:
+		float* ox = o + BonePose::RX * stride; float const* px = p + BonePose::RX * stride;
+		float* oy = o + BonePose::RY * stride; float const* py = p + BonePose::RY * stride;
+		float* oz = o + BonePose::RZ * stride; float const* pz = p + BonePose::RZ * stride;
+		float* ow = o + BonePose::RW * stride; float const* pw = p + BonePose::RW * stride;
+#ifdef BONE_ANIMATION_USE_SSE
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		const __m128 vw = _mm_set1_ps(w);
+		for (uint32_t i = 0; i < stride; i += 4) {
+			__m128 x = _mm_loadu_ps(ox + i), y = _mm_loadu_ps(oy + i), z = _mm_loadu_ps(oz + i), q = _mm_loadu_ps(ow + i);
+			__m128 qx = _mm_loadu_ps(px + i), qy = _mm_loadu_ps(py + i), qz = _mm_loadu_ps(pz + i), qw = _mm_loadu_ps(pw + i);
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, qx), _mm_mul_ps(y, qy)), _mm_add_ps(_mm_mul_ps(z, qz), _mm_mul_ps(q, qw)));
+			__m128 lw = _mm_xor_ps(vw, _mm_and_ps(d, sign));
+			_mm_storeu_ps(ox + i, _mm_add_ps(x, _mm_mul_ps(qx, lw)));
+			_mm_storeu_ps(oy + i, _mm_add_ps(y, _mm_mul_ps(qy, lw)));
+			_mm_storeu_ps(oz + i, _mm_add_ps(z, _mm_mul_ps(qz, lw)));
+			_mm_storeu_ps(ow + i, _mm_add_ps(q, _mm_mul_ps(qw, lw)));
+		}
+#else
+		for (uint32_t i = 0; i < stride; ++i) {
+			float d = ox[i] * px[i] + oy[i] * py[i] + oz[i] * pz[i] + ow[i] * pw[i];
+			float lw = (d < 0.0f ? -w : w);
+			ox[i] += px[i] * lw;
+			oy[i] += py[i] * lw;
+			oz[i] += pz[i] * lw;
+			ow[i] += pw[i] * lw;
+		}
+#endif
+	}
+
+	//renormalize rotations:
+	float* ox = o + BonePose::RX * stride;
+	float* oy = o + BonePose::RY * stride;
+	float* oz = o + BonePose::RZ * stride;
+	float* ow = o + BonePose::RW * stride;
+#ifdef BONE_ANIMATION_USE_SSE
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 tiny = _mm_set1_ps(1e-20f);
+	for (uint32_t i = 0; i < stride; i += 4) {
+		__m128 x = _mm_loadu_ps(ox + i), y = _mm_loadu_ps(oy + i), z = _mm_loadu_ps(oz + i), w = _mm_loadu_ps(ow + i);
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+		__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(len2, tiny)));
+		_mm_storeu_ps(ox + i, _mm_mul_ps(x, inv));
+		_mm_storeu_ps(oy + i, _mm_mul_ps(y, inv));
+		_mm_storeu_ps(oz + i, _mm_mul_ps(z, inv));
+		_mm_storeu_ps(ow + i, _mm_mul_ps(w, inv));
+	}
+#else
+	for (uint32_t i = 0; i < stride; ++i) {
+		float len2 = ox[i] * ox[i] + oy[i] * oy[i] + oz[i] * oz[i] + ow[i] * ow[i];
+		float inv = 1.0f / std::sqrt(std::max(len2, 1e-20f));
+		ox[i] *= inv;
+		oy[i] *= inv;
+		oz[i] *= inv;
+		ow[i] *= inv;
+	}
+#endif
+}
+
+namespace {
+	//out = a * b for affine transforms (as if each had a (0,0,0,1) row); out must not alias a or b:
+	void affine_multiply(glm::mat4x3 const& a, glm::mat4x3 const& b, glm::mat4x3* out) {
+		static_assert(sizeof(glm::mat4x3) == 12 * 4, "mat4x3 is 12 packed floats");
+		float const* af = &a[0][0];
+		float const* bf = &b[0][0];
+		float* of = &(*out)[0][0];
+#ifdef BONE_ANIMATION_USE_SSE
+		//columns of 'a' ('w' lanes hold junk that never gets stored); the last column is loaded from one float early to stay in bounds:
+		const __m128 a0 = _mm_loadu_ps(af + 0);
+		const __m128 a1 = _mm_loadu_ps(af + 3);
+		const __m128 a2 = _mm_loadu_ps(af + 6);
+		const __m128 a3 = _mm_shuffle_ps(_mm_loadu_ps(af + 8), _mm_loadu_ps(af + 8), _MM_SHUFFLE(3, 3, 2, 1));
+		auto column = [&](uint32_t c) {
+			return _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(bf[3 * c + 0])), _mm_mul_ps(a1, _mm_set1_ps(bf[3 * c + 1]))),
+				_mm_mul_ps(a2, _mm_set1_ps(bf[3 * c + 2]))
+			);
+		};
+		__m128 c3 = _mm_add_ps(column(3), a3);
+		//overlapping stores (each column's 'w' is overwritten by the next column's 'x'):
+		_mm_storeu_ps(of + 0, column(0));
+		_mm_storeu_ps(of + 3, column(1));
+		_mm_storeu_ps(of + 6, column(2));
+		_mm_storel_pi(reinterpret_cast< __m64 * >(of + 9), c3);
+		_mm_store_ss(of + 11, _mm_shuffle_ps(c3, c3, _MM_SHUFFLE(2, 2, 2, 2)));
+#else
+		for (uint32_t c = 0; c < 4; ++c) {
+			for (uint32_t r = 0; r < 3; ++r) {
+				of[3 * c + r] = af[r] * bf[3 * c + 0] + af[3 + r] * bf[3 * c + 1] + af[6 + r] * bf[3 * c + 2] + (c == 3 ? af[9 + r] : 0.0f);
+			}
+		}
+#endif
+	}
+}
+
+void pose_to_matrices(BoneAnimation const& banims, BonePose const& pose, std::vector< glm::mat4x3 >* bone_to_object_, std::vector< glm::mat4x3 >* bone_matrices_, uint32_t depth_limit) {
+	assert(bone_to_object_);
+	auto& bone_to_object = *bone_to_object_;
+	assert(bone_matrices_);
+	auto& bone_matrices = *bone_matrices_;
+	assert(pose.bones == banims.bones.size() && bone_to_object.size() == pose.bones && bone_matrices.size() == pose.bones);
+
+	for (uint32_t b = 0; b < pose.bones; ++b) {
+		BoneAnimation::Bone const& bone = banims.bones[b];
+
+		if (bone.depth > depth_limit) {
+			bone_matrices[b] = bone_matrices[bone.parent];
+			continue;
+		}
+
+		if (bone.parent == -1U) {
+			bone_to_object[b] = glm::mat4x3(1.0f); //clear root position
+		}
+		else {
+			glm::mat3 r = glm::mat3_cast(glm::quat(pose[BonePose::RW][b], pose[BonePose::RX][b], pose[BonePose::RY][b], pose[BonePose::RZ][b]));
+			glm::mat4x3 trs = glm::mat4x3(
+				r[0] * pose[BonePose::SX][b],
+				r[1] * pose[BonePose::SY][b],
+				r[2] * pose[BonePose::SZ][b],
+				glm::vec3(pose[BonePose::PX][b], pose[BonePose::PY][b], pose[BonePose::PZ][b])
+			);
+			affine_multiply(bone_to_object[bone.parent], trs, &bone_to_object[b]);
+		}
+		affine_multiply(bone_to_object[b], bone.inverse_bind_matrix, &bone_matrices[b]);
+	}
+}
+
+void BoneAnimation::bake() {
+	BonePose pose;
+	pose.resize((uint32_t) bones.size());
+	std::vector< glm::mat4x3 > bone_to_object(bones.size());
+	std::vector< glm::mat4x3 > bone_matrices(bones.size());
+
+	baked.clear();
+	baked.reserve(size_t(frames) * bones.size());
+	for (uint32_t f = 0; f < frames; ++f) {
+		sample_frame(float(f), &pose);
+		pose_to_matrices(*this, pose, &bone_to_object, &bone_matrices);
+		baked.insert(baked.end(), bone_matrices.begin(), bone_matrices.end());
+	}
+}
+
+//------------ players ------------
+
 BoneAnimationPlayer::BoneAnimationPlayer(BoneAnimation const& banims_, BoneAnimation::Animation const& anim_, LoopOrOnce loop_or_once_, float speed) : banims(banims_), anim(anim_), loop_or_once(loop_or_once_) {
 	set_speed(speed);
+	pose.resize((uint32_t) banims.bones.size());
+	bone_to_object.resize(banims.bones.size());
+	bone_matrices.resize(banims.bones.size());
 }
 
 void BoneAnimationPlayer::update(float elapsed) {
@@ -210,50 +753,179 @@ void BoneAnimationPlayer::update(float elapsed) {
 	}
 }
 
-void BoneAnimationPlayer::set_uniform(GLint bones_mat4x3_array) const {
-	std::vector< glm::mat4x3 > bone_to_object(banims.bones.size()); //needed for hierarchy
-	std::vector< glm::mat4x3 > bones(banims.bones.size()); //actual uniforms
-
+uint32_t BoneAnimationPlayer::current_frame() const {
 	int32_t frame = (int32_t) std::floor((anim.end - 1 - anim.begin) * position + anim.begin);
 	if (frame < int32_t(anim.begin)) frame = anim.begin;
 	if (frame > int32_t(anim.end) - 1) frame = int32_t(anim.end) - 1;
-	//std::cout << "Frame " << frame << std::endl;
-	BoneAnimation::PoseBone const* pose = banims.get_frame(frame);
-	for (uint32_t b = 0; b < bones.size(); ++b) {
-		BoneAnimation::PoseBone const& pose_bone = pose[b];
-		BoneAnimation::Bone const& bone = banims.bones[b];
-		
-		//if (b == 0)
-		//	std::cout << "Bone " << b << " " << glm::to_string(pose_bone.position) << std::endl;
-
-		glm::mat3 r = glm::mat3_cast(pose_bone.rotation);
-		//glm::mat3 r = glm::mat3_cast(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
-		//std::cout << glm::to_string(r) << std::endl;
-		glm::mat3 rs = glm::mat3(
-			r[0] * pose_bone.scale.x,
-			r[1] * pose_bone.scale.y,
-			r[2] * pose_bone.scale.z
-		);
-		/*glm::mat3 rs = glm::mat3(
-			r[0], r[1], r[2]
-		);*/
-		//std::cout << glm::to_string(rs) << std::endl;
-		glm::mat4x3 trs = glm::mat4x3(
-			rs[0], rs[1], rs[2], pose_bone.position
-		);
-		/*glm::mat4x3 trs = glm::mat4x3(
-			rs[0], rs[1], rs[2], glm::vec3(0.0f, 0.0f, 0.0f)
-		);*/
-		//std::cout << glm::to_string(trs) << std::endl;
+	return uint32_t(frame);
+}
 
-		if (bone.parent == -1U) {
-			bone_to_object[b] = trs;
-			bone_to_object[b] = glm::mat4x3(1.0f); //clear root position
-		}
-		else {
-			bone_to_object[b] = bone_to_object[bone.parent] * glm::mat4(trs);
+void BoneAnimationPlayer::sample() {
+	if (position == sampled_position && depth_limit == sampled_depth_limit) return;
+	sampled_position = position;
+	sampled_depth_limit = depth_limit;
+	sample_pose(banims, anim, position, &pose, depth_limit);
+}
+
+void BoneAnimationPlayer::evaluate() {
+	if (!banims.baked.empty()) return; //matrices() reads straight from banims
+	if (position == evaluated_position && depth_limit == evaluated_depth_limit) return;
+	evaluated_position = position;
+	evaluated_depth_limit = depth_limit;
+	sample();
+	pose_to_matrices(banims, pose, &bone_to_object, &bone_matrices, depth_limit);
+}
+
+void BoneAnimationMixer::crossfade(BoneAnimationPlayer* player, float duration) {
+	assert(player);
+	if (duration <= 0.0f || layers.empty()) { //nothing to fade
+		layers.clear();
+		set_weight(player, 1.0f);
+		return;
+	}
+
+	uint32_t index = 0;
+	while (index < layers.size() && layers[index].player != player) ++index;
+	if (index < layers.size() && layers[index].target == 1.0f) return; //already fading (or faded) in
+	if (index == layers.size()) {
+		layers.emplace_back();
+		layers.back().player = player;
+	}
+
+	for (uint32_t l = 0; l < layers.size(); ++l) {
+		layers[l].target = (l == index ? 1.0f : 0.0f);
+		layers[l].rate = 1.0f / duration;
+	}
+}
+
+void BoneAnimationMixer::set_weight(BoneAnimationPlayer* player, float weight) {
+	assert(player);
+	assert(layers.empty() || &layers[0].player->banims == &player->banims);
+	auto f = std::find_if(layers.begin(), layers.end(), [&](Layer const& layer) { return layer.player == player; });
+	if (weight <= 0.0f) {
+		if (f != layers.end()) layers.erase(f);
+		return;
+	}
+	if (f == layers.end()) {
+		layers.emplace_back();
+		f = layers.end() - 1;
+		f->player = player;
+	}
+	f->weight = f->target = weight;
+	f->rate = 0.0f;
+}
+
+void BoneAnimationMixer::update(float elapsed) {
+	for (auto& layer : layers) {
+		float step = layer.rate * elapsed;
+		if (layer.weight < layer.target) layer.weight = std::min(layer.weight + step, layer.target);
+		else layer.weight = std::max(layer.weight - step, layer.target);
+	}
+	layers.erase(std::remove_if(layers.begin(), layers.end(), [](Layer const& layer) {
+		return layer.weight <= 0.0f && layer.target <= 0.0f;
+	}), layers.end());
+}
+
+void BoneAnimationMixer::evaluate() {
+	uint32_t active = 0;
+	for (auto const& layer : layers) {
+		if (layer.weight > 0.0f) ++active;
+	}
+	if (active == 0) return; //keep whatever was there
+
+	//nothing to do if the same layers are at the same positions and weights as last time:
+	bool same = (depth_limit == evaluated_depth_limit && !bone_matrices.empty() && active == evaluated.size());
+	for (uint32_t l = 0, e = 0; same && l < layers.size(); ++l) {
+		Layer const& layer = layers[l];
+		if (layer.weight <= 0.0f) continue;
+		Evaluated const& was = evaluated[e++];
+		same = (was.player == layer.player && was.position == layer.player->position && was.weight == layer.weight);
+	}
+	if (same) return;
+	evaluated.clear();
+	for (auto const& layer : layers) {
+		if (layer.weight > 0.0f) evaluated.emplace_back(Evaluated{layer.player, layer.player->position, layer.weight});
+	}
+	evaluated_depth_limit = depth_limit;
+
+	BoneAnimation const& banims = layers[0].player->banims;
+	bone_to_object.resize(banims.bones.size());
+	bone_matrices.resize(banims.bones.size());
+
+	//a lone baked layer needs no work at all:
+	baked_player = nullptr;
+	if (active == 1 && !banims.baked.empty()) {
+		for (auto const& layer : layers) {
+			if (layer.weight > 0.0f) baked_player = layer.player;
 		}
-		bones[b] = bone_to_object[b] * glm::mat4(bone.inverse_bind_matrix);
+		return;
+	}
+
+	layer_poses.clear();
+	layer_weights.clear();
+	for (auto& layer : layers) {
+		if (layer.weight <= 0.0f) continue;
+		layer.player->depth_limit = depth_limit;
+		layer.player->sample();
+		layer_poses.emplace_back(&layer.player->pose);
+		layer_weights.emplace_back(layer.weight);
+	}
+
+	if (layer_poses.size() == 1) {
+		pose_to_matrices(banims, *layer_poses[0], &bone_to_object, &bone_matrices, depth_limit);
+		return;
 	}
-	glUniformMatrix4x3fv(bones_mat4x3_array, (GLsizei) bones.size(), GL_FALSE, glm::value_ptr(bones[0]));
-}
\ No newline at end of file
+	if (layer_poses.size() == 2) {
+		blend_poses(*layer_poses[0], *layer_poses[1], layer_weights[1] / (layer_weights[0] + layer_weights[1]), &pose);
+	}
+	else {
+		blend_poses(layer_poses.data(), layer_weights.data(), (uint32_t) layer_poses.size(), &pose);
+	}
+	pose_to_matrices(banims, pose, &bone_to_object, &bone_matrices, depth_limit);
+}
+
+//------------ palette ------------
+
+BonePalette::BonePalette() {
+	static_assert(sizeof(glm::mat4x3) == 3 * 4 * 4, "mat4x3 is three RGBA32F texels");
+	buffer_size = 64 * sizeof(glm::mat4x3);
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	GL_ERRORS();
+}
+
+BonePalette::~BonePalette() {
+	glDeleteTextures(1, &texture);
+	texture = 0;
+	glDeleteBuffers(1, &buffer);
+	buffer = 0;
+}
+
+uint32_t BonePalette::append(glm::mat4x3 const* bone_matrices, uint32_t count) {
+	uint32_t offset = (uint32_t) matrices.size();
+	matrices.insert(matrices.end(), bone_matrices, bone_matrices + count);
+	return offset;
+}
+
+void BonePalette::upload() {
+	size_t size = matrices.size() * sizeof(glm::mat4x3);
+	if (size == 0) return;
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	while (buffer_size < size) buffer_size *= 2;
+	//(re-specifying the store lets the driver hand back fresh memory instead of waiting on last frame's draws)
+	glBufferData(GL_TEXTURE_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, size, matrices.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	GL_ERRORS();
+}
@@ -13,6 +13,8 @@
 // a heirarchy of bones and their bind info,
 // and a collection of animations defined on those bones
 
+struct BonePose;
+
 struct BoneAnimation {
 	//Skinned mesh:
 	GLuint vbo = 0;
@@ -29,19 +31,60 @@ struct BoneAnimation {
 		std::string name;
 		uint32_t parent = -1U;
 		glm::mat4x3 inverse_bind_matrix;
+		uint32_t depth = 0; //number of ancestors (used to pick reduced bone sets for level-of-detail)
 	};
 	std::vector< Bone > bones;
 
-	//Animation poses:
+	//Animation poses (as stored in the file; compressed at load, see below):
 	struct PoseBone {
 		glm::vec3 position;
 		glm::quat rotation;
 		glm::vec3 scale;
 	};
-	std::vector< PoseBone > frame_bones;
 
-	PoseBone const* get_frame(uint32_t frame) const {
-		return &frame_bones[frame * bones.size()];
+	//Compressed poses:
+	// each bone has a position, rotation, and scale track;
+	// tracks that never change (within tolerance) hold a single value,
+	// others hold quantized keys (16 bits per position/scale component,
+	// "smallest three" for rotations) with in-between frames dropped wherever
+	// interpolating the neighboring keys reproduces them within tolerance.
+	enum Channel : uint32_t { PositionChannel, RotationChannel, ScaleChannel, Channels };
+	struct Track {
+		glm::vec4 base = glm::vec4(0.0f); //constant tracks: the value (rotations as xyzw); position/scale keys: range minimum
+		glm::vec3 step = glm::vec3(0.0f); //position/scale keys: quantization step
+		uint32_t first_key = 0; //index into 'keys'
+		uint32_t key_count = 0; //zero for a constant track
+	};
+	struct Key {
+		uint16_t frame;
+		uint16_t data[3];
+	};
+	static_assert(sizeof(Key) == 2 + 2 * 3, "Key is packed.");
+	uint32_t frames = 0; //total frames (over all animations)
+	std::vector< Track > tracks; //bones.size() * Channels, indexed by bone * Channels + channel
+	std::vector< Key > keys;
+
+	//largest error (in model units, radians, and scale factor) allowed when dropping keys:
+	static constexpr float PositionTolerance = 0.0005f;
+	static constexpr float RotationTolerance = 0.001f;
+	static constexpr float ScaleTolerance = 0.0005f;
+
+	//write every bone's local transform at (fractional) frame 'at' into 'out' (which should already be sized for these bones):
+	// (bones deeper than 'depth_limit' are skipped)
+	void sample_frame(float at, BonePose* out, uint32_t depth_limit = -1U) const;
+
+	//Baked skinning matrices (optional):
+	// final bone matrices for every frame, stored contiguously (frame f starts at baked[f * bones.size()]).
+	// Players of a baked animation play back whole frames and skip evaluation entirely,
+	// at a cost of 48 bytes per bone per frame.
+	// Whole frames aren't interpolated, so this is opt-in (e.g. for distant or background characters).
+	std::vector< glm::mat4x3 > baked;
+
+	//fill in 'baked' (from the compressed poses, so results match unbaked playback at whole frames):
+	void bake();
+
+	glm::mat4x3 const* get_baked(uint32_t frame) const {
+		return &baked[frame * bones.size()];
 	}
 
 	//Animation index:
@@ -65,8 +108,43 @@ struct BoneAnimation {
 	//  will throw if program defines attributes not contained in this buffer
 	//  and warn if this buffer contains attributes not active in the program
 	GLuint make_vao_for_program(GLuint program) const;
+
+	//(used by the constructor) build 'tracks' / 'keys' from uncompressed poses:
+	void compress_poses(std::vector< PoseBone > const& frame_bones);
+};
+
+//"BonePose" holds a local (parent-relative) transform for every bone in structure-of-arrays form:
+// each component gets its own array, padded to a multiple of four bones, so that sampling
+// and blending work on four bones at a time (padding lanes hold an identity transform).
+struct BonePose {
+	enum Component : uint32_t { PX, PY, PZ, RX, RY, RZ, RW, SX, SY, SZ, Components };
+
+	void resize(uint32_t bones);
+
+	float* operator[](uint32_t component) { return data.data() + component * stride; }
+	float const* operator[](uint32_t component) const { return data.data() + component * stride; }
+
+	uint32_t bones = 0;
+	uint32_t stride = 0; //bones rounded up to a multiple of four
+	std::vector< float > data; //Components arrays of 'stride' floats each
 };
 
+//sample 'anim' at 'position' (0.0 == first frame, 1.0 == last frame), interpolating between keys:
+// (positions and scales are lerped, rotations nlerped)
+void sample_pose(BoneAnimation const& banims, BoneAnimation::Animation const& anim, float position, BonePose* out, uint32_t depth_limit = -1U);
+
+//two-way blend, 'amt' of the way from a to b (slerp for rotations):
+void blend_poses(BonePose const& a, BonePose const& b, float amt, BonePose* out);
+
+//N-way weighted blend (weights need not sum to one, but should not all be zero):
+// rotations are accumulated in the hemisphere of the first pose and renormalized (nlerp)
+void blend_poses(BonePose const* const* poses, float const* weights, uint32_t count, BonePose* out);
+
+//walk the hierarchy to turn a pose into skinning matrices:
+// (bone_to_object is scratch space; both vectors should already have one entry per bone)
+// bones deeper than 'depth_limit' just reuse their parent's matrix (i.e., stay rigidly in bind pose relative to it)
+void pose_to_matrices(BoneAnimation const& banims, BonePose const& pose, std::vector< glm::mat4x3 >* bone_to_object, std::vector< glm::mat4x3 >* bone_matrices, uint32_t depth_limit = -1U);
+
 struct BoneAnimationPlayer {
 	enum LoopOrOnce { Once, Loop };
 	BoneAnimationPlayer(BoneAnimation const& banims, BoneAnimation::Animation const& anim, LoopOrOnce loop_or_once = Once, float speed = 1.0f);
@@ -81,11 +159,113 @@ struct BoneAnimationPlayer {
 	float position = 0.0f; //from 0.0 == beginning to 1.0 == end
 	float position_per_second = 1.0f;
 	LoopOrOnce loop_or_once = Once;
+	uint32_t depth_limit = -1U; //level-of-detail: bones deeper than this follow their parents
 
 	void update(float elapsed);
 
-	void set_uniform(GLint bones_mat4x3_array) const;
+	//sample the (interpolated) local pose at the current position into 'pose':
+	// (does nothing if 'position' hasn't changed since the last sample)
+	void sample();
+
+	//compute bone matrices for the current position into 'bone_matrices':
+	// (does nothing if 'position' hasn't changed since the last evaluate, or if banims is baked)
+	void evaluate();
+
+	//the current bone matrices (a frame of banims.baked if baked, otherwise 'bone_matrices' as of the last evaluate):
+	glm::mat4x3 const* matrices() const {
+		return banims.baked.empty() ? bone_matrices.data() : banims.get_baked(current_frame());
+	}
 
 	bool done() const { return (loop_or_once == Once && position >= 1.0f); }
 
-};
\ No newline at end of file
+	//frame of banims that 'position' currently maps to (rounded down):
+	uint32_t current_frame() const;
+
+	//-- internals ---
+	//pose buffers, sized once at construction so evaluate() never allocates:
+	BonePose pose; //local transforms
+	std::vector< glm::mat4x3 > bone_to_object; //needed for hierarchy
+	std::vector< glm::mat4x3 > bone_matrices; //actual uniforms
+	float sampled_position = -1.0f; //position currently held in 'pose' (-1 if none)
+	float evaluated_position = -1.0f; //position currently held in 'bone_matrices' (-1 if none)
+	uint32_t sampled_depth_limit = -1U; //depth_limit 'pose' was sampled with
+	uint32_t evaluated_depth_limit = -1U; //depth_limit 'bone_matrices' were computed with
+};
+
+//"BoneAnimationMixer" blends several players of the same skeleton by weight, with timed crossfades:
+// (players keep their own positions; advance them with their own update() as usual)
+struct BoneAnimationMixer {
+	//fade 'player' up to full weight over 'duration' seconds while fading all other layers out:
+	// (a duration of zero switches immediately; crossfading to the current target does nothing)
+	void crossfade(BoneAnimationPlayer* player, float duration);
+
+	//set a layer's weight directly (adding the layer if needed; zero removes it):
+	void set_weight(BoneAnimationPlayer* player, float weight);
+
+	//advance fades:
+	void update(float elapsed);
+
+	//blend all layers into 'bone_matrices':
+	// (a lone baked layer is passed through instead; see matrices())
+	// (does nothing if no layer's position or weight, nor depth_limit, has changed since the last evaluate)
+	void evaluate();
+
+	//the current bone matrices (bone_matrices.size() of them) as of the last evaluate:
+	glm::mat4x3 const* matrices() const {
+		return baked_player ? baked_player->matrices() : bone_matrices.data();
+	}
+
+	void clear() { layers.clear(); baked_player = nullptr; evaluated.clear(); }
+
+	uint32_t depth_limit = -1U; //level-of-detail: bones deeper than this follow their parents (passed on to layers)
+
+	//-- internals ---
+	struct Layer {
+		BoneAnimationPlayer* player = nullptr;
+		float weight = 0.0f;
+		float target = 0.0f; //weight being faded toward
+		float rate = 0.0f; //weight change per second
+	};
+	std::vector< Layer > layers;
+
+	BonePose pose; //blended local transforms
+	std::vector< BonePose const* > layer_poses; //scratch for evaluate()
+	std::vector< float > layer_weights; //scratch for evaluate()
+	std::vector< glm::mat4x3 > bone_to_object;
+	std::vector< glm::mat4x3 > bone_matrices;
+	BoneAnimationPlayer const* baked_player = nullptr; //set by evaluate() when the only layer is baked
+	//what the last evaluate() computed from (its active layers, in order):
+	struct Evaluated {
+		BoneAnimationPlayer const* player;
+		float position;
+		float weight;
+	};
+	std::vector< Evaluated > evaluated;
+	uint32_t evaluated_depth_limit = -1U;
+};
+
+//"BonePalette" gathers the bone matrices of every skinned drawable in a frame into one texture buffer,
+// so draws only set an offset into it (and skeletons may have any number of bones):
+struct BonePalette {
+	BonePalette();
+	~BonePalette();
+	BonePalette(BonePalette const&) = delete;
+
+	//forget the previous frame's matrices:
+	// (a palette that is filled and uploaded once, e.g. with BoneAnimation::baked, may also be used as-is every frame)
+	void clear() { matrices.clear(); }
+
+	//add a drawable's bone matrices; returns the offset (in matrices) to pass as its 'bones_offset':
+	uint32_t append(glm::mat4x3 const* bone_matrices, uint32_t count);
+	uint32_t append(std::vector< glm::mat4x3 > const& bone_matrices) {
+		return append(bone_matrices.data(), (uint32_t) bone_matrices.size());
+	}
+
+	//send everything appended since clear() to the texture buffer (call before drawing):
+	void upload();
+
+	std::vector< glm::mat4x3 > matrices;
+	GLuint buffer = 0; //data store for 'texture'
+	GLuint texture = 0; //GL_TEXTURE_BUFFER (GL_RGBA32F, three texels per matrix) over 'buffer'
+	size_t buffer_size = 0; //bytes allocated in 'buffer'
+};
@@ -1,7 +1,14 @@
 #include "Collision.hpp"
 
 #include <algorithm>
+#include <cassert>
 #include <iostream>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLLISION_USE_SSE 1
+#include <xmmintrin.h>
+#endif
 // test collision between two AABB boxes
 int Collision::testAABBAABB(const AABB& a, const AABB& b)
 {
@@ -15,8 +22,8 @@ int Collision::testAABBAABB(const AABB& a, const AABB& b)
 	// did the player collide more on the x side or the y side?
 	// if b.c.x is contained between sides x1 x2 of a -> collision in y
 	// if b.c.y is contained between sides y1 y2 of a -> collision in x
-	float dist_x = std::min(abs((a.c.x + a.r.x) - (b.c.x - b.r.x)), abs((a.c.x - a.r.x) - (b.c.x + b.r.x)));
-	float dist_y = std::min(abs((a.c.y + a.r.y) - (b.c.y - b.r.y)), abs((a.c.y - a.r.y) - (b.c.y + b.r.y)));
+	float dist_x = std::min(std::abs((a.c.x + a.r.x) - (b.c.x - b.r.x)), std::abs((a.c.x - a.r.x) - (b.c.x + b.r.x)));
+	float dist_y = std::min(std::abs((a.c.y + a.r.y) - (b.c.y - b.r.y)), std::abs((a.c.y - a.r.y) - (b.c.y + b.r.y)));
 	// collision in x
 	if (dist_x < dist_y) 
 	{
@@ -43,6 +50,148 @@ bool Collision::testAABBAABBXYStrict(const AABB& a, const AABB& b)
 	return true;
 }
 
+Collision::OBB Collision::OBB::from_bounds(const glm::vec3& min, const glm::vec3& max, const glm::mat4x3& local_to_world)
+{
+	glm::vec3 center = 0.5f * (min + max);
+	glm::vec3 half = 0.5f * (max - min);
+	OBB ret(local_to_world * glm::vec4(center, 1.0f), glm::mat3(1.0f), half);
+	for (int k = 0; k < 3; ++k)
+	{
+		float length = glm::length(local_to_world[k]);
+		ret.e[k] = half[k] * length;
+		if (length != 0.0f) { ret.u[k] = local_to_world[k] / length; } // (zero scale: keep the world axis, with zero extent)
+	}
+	return ret;
+}
+
+Collision::AABB Collision::boundsOBB(const OBB& a)
+{
+	glm::vec3 r = glm::abs(a.u[0]) * a.e.x + glm::abs(a.u[1]) * a.e.y + glm::abs(a.u[2]) * a.e.z;
+	return AABB(a.c, r);
+}
+
+namespace
+{
+	// added to |R| so that near-parallel edge pairs (whose cross product is almost zero) can't report a false separation
+	const float SATEpsilon = 1e-6f;
+
+	// separating axis test (Ericson 4.4.1) with everything expressed in a's frame:
+	//  R[i][j] = dot(a.u[i], b.u[j]), t = b.c - a.c in a's frame
+	// axes are tried in order: a's faces, b's faces (optional; OBB-AABB tests them first itself), then the nine edge pairs
+	bool sat_test(const float R[3][3], const float AbsR[3][3], const float t[3], const glm::vec3& ea, const glm::vec3& eb, bool b_faces)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			float rb = eb[0] * AbsR[i][0] + eb[1] * AbsR[i][1] + eb[2] * AbsR[i][2];
+			if (std::abs(t[i]) > ea[i] + rb) { return false; }
+		}
+		if (b_faces)
+		{
+			for (int j = 0; j < 3; ++j)
+			{
+				float ra = ea[0] * AbsR[0][j] + ea[1] * AbsR[1][j] + ea[2] * AbsR[2][j];
+				if (std::abs(t[0] * R[0][j] + t[1] * R[1][j] + t[2] * R[2][j]) > ra + eb[j]) { return false; }
+			}
+		}
+		for (int i = 0; i < 3; ++i)
+		{
+			int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+			for (int j = 0; j < 3; ++j)
+			{
+				int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+				float ra = ea[i1] * AbsR[i2][j] + ea[i2] * AbsR[i1][j];
+				float rb = eb[j1] * AbsR[i][j2] + eb[j2] * AbsR[i][j1];
+				if (std::abs(t[i2] * R[i1][j] - t[i1] * R[i2][j]) > ra + rb) { return false; }
+			}
+		}
+		return true;
+	}
+
+	// the parts of an OBB vs AABB test that only depend on the OBB:
+	struct OBBQuery
+	{
+		OBBQuery(const Collision::OBB& a) : c(a.c), e(a.e)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					R[i][k] = a.u[i][k];
+					AbsR[i][k] = std::abs(R[i][k]) + SATEpsilon;
+				}
+			}
+			r_world = Collision::boundsOBB(a).r;
+		}
+		glm::vec3 c, e;
+		float R[3][3];    // R[i][k] = world component k of a's axis i
+		float AbsR[3][3];
+		glm::vec3 r_world; // a's radius along each world axis
+	};
+
+	bool test_query_aabb(const OBBQuery& q, const glm::vec3& bc, const glm::vec3& br)
+	{
+		// b's face axes are the world axes, which are cheap to test and most likely to separate, so go first:
+		glm::vec3 tw = bc - q.c;
+		if (std::abs(tw.x) > q.r_world.x + br.x) { return false; }
+		if (std::abs(tw.y) > q.r_world.y + br.y) { return false; }
+		if (std::abs(tw.z) > q.r_world.z + br.z) { return false; }
+		float t[3];
+		for (int i = 0; i < 3; ++i) { t[i] = q.R[i][0] * tw.x + q.R[i][1] * tw.y + q.R[i][2] * tw.z; }
+		return sat_test(q.R, q.AbsR, t, q.e, br, false);
+	}
+
+	// side classification for the general tests; OBBs are classified by their bounds
+	Collision::AABB bounds(const Collision::Primitive& a)
+	{
+		if (a.type == Collision::PrimitiveType::OBB) { return Collision::boundsOBB(static_cast<const Collision::OBB&>(a)); }
+		return static_cast<const Collision::AABB&>(a);
+	}
+}
+
+bool Collision::testOBBOBB(const OBB& a, const OBB& b)
+{
+	float R[3][3], AbsR[3][3];
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			R[i][j] = glm::dot(a.u[i], b.u[j]);
+			AbsR[i][j] = std::abs(R[i][j]) + SATEpsilon;
+		}
+	}
+	glm::vec3 tw = b.c - a.c;
+	float t[3] = { glm::dot(tw, a.u[0]), glm::dot(tw, a.u[1]), glm::dot(tw, a.u[2]) };
+	return sat_test(R, AbsR, t, a.e, b.e, true);
+}
+
+bool Collision::testOBBAABB(const OBB& a, const AABB& b)
+{
+	return test_query_aabb(OBBQuery(a), b.c, b.r);
+}
+
+void Collision::testOBBOBBs(const OBB& a, const std::vector<OBB>& boxes, const std::vector<uint32_t>& candidates, std::vector<uint32_t>* hits)
+{
+	glm::vec3 r_a = boundsOBB(a).r;
+	for (uint32_t i : candidates)
+	{
+		const OBB& b = boxes[i];
+		// cheap rejection on the boxes' bounds before the full test:
+		glm::vec3 r_b = boundsOBB(b).r;
+		glm::vec3 d = glm::abs(b.c - a.c);
+		if (d.x > r_a.x + r_b.x || d.y > r_a.y + r_b.y || d.z > r_a.z + r_b.z) { continue; }
+		if (testOBBOBB(a, b)) { hits->emplace_back(i); }
+	}
+}
+
+void Collision::testOBBAABBs(const OBB& a, const std::vector<AABB>& boxes, const std::vector<uint32_t>& candidates, std::vector<uint32_t>* hits)
+{
+	OBBQuery q(a);
+	for (uint32_t i : candidates)
+	{
+		if (test_query_aabb(q, boxes[i].c, boxes[i].r)) { hits->emplace_back(i); }
+	}
+}
+
 // general function, can add more primitive types here
 int Collision::testCollision(const Primitive& a, const Primitive& b)
 {
@@ -50,23 +199,776 @@ int Collision::testCollision(const Primitive& a, const Primitive& b)
 	{
 		return testAABBAABB(static_cast<const AABB&>(a), static_cast<const AABB&>(b));
 	}
-	return 0;
+	bool hit = false;
+	if (a.type == PrimitiveType::OBB && b.type == PrimitiveType::OBB)
+	{
+		hit = testOBBOBB(static_cast<const OBB&>(a), static_cast<const OBB&>(b));
+	}
+	else if (a.type == PrimitiveType::OBB && b.type == PrimitiveType::AABB)
+	{
+		hit = testOBBAABB(static_cast<const OBB&>(a), static_cast<const AABB&>(b));
+	}
+	else if (a.type == PrimitiveType::AABB && b.type == PrimitiveType::OBB)
+	{
+		hit = testOBBAABB(static_cast<const OBB&>(b), static_cast<const AABB&>(a));
+	}
+	if (!hit) { return 0; }
+	// x or y side, same rule as testAABBAABB (the bounds overlap whenever the boxes do):
+	int side = testAABBAABB(bounds(a), bounds(b));
+	return side ? side : 2;
 }
 
+// the XY tests treat OBBs as their bounds
 bool Collision::testCollisionXY(const Primitive& a, const Primitive& b)
 {
-	if (a.type == PrimitiveType::AABB && b.type == PrimitiveType::AABB)
+	return testAABBAABBXY(bounds(a), bounds(b));
+}
+
+bool Collision::testCollisionXYStrict(const Primitive& a, const Primitive& b)
+{
+	return testAABBAABBXYStrict(bounds(a), bounds(b));
+}
+
+// swept test: move a point (a's center) against b grown by a's radius, clipping the move to each slab in turn
+bool Collision::sweepAABBAABB(const AABB& a, const glm::vec3& move, const AABB& b, float* t, glm::vec3* normal)
+{
+	glm::vec3 r = a.r + b.r;
+	glm::vec3 d = a.c - b.c;
+	float t_enter = 0.0f;
+	float t_exit = 1.0f;
+	int enter_axis = -1;
+	for (int k = 0; k < 3; ++k)
 	{
-		return testAABBAABBXY(static_cast<const AABB&>(a), static_cast<const AABB&>(b));
+		if (move[k] == 0.0f)
+		{
+			// not moving along this axis: must already overlap in it
+			if (std::abs(d[k]) > r[k]) { return false; }
+			continue;
+		}
+		float t0 = (-r[k] - d[k]) / move[k];
+		float t1 = ( r[k] - d[k]) / move[k];
+		if (t0 > t1) { std::swap(t0, t1); }
+		if (t0 > t_enter) { t_enter = t0; enter_axis = k; }
+		t_exit = std::min(t_exit, t1);
+		if (t_enter > t_exit) { return false; }
 	}
-	return false;	
+
+	*t = t_enter;
+	*normal = glm::vec3(0.0f);
+	// contact is on the axis whose slab was entered last
+	if (enter_axis >= 0) { (*normal)[enter_axis] = (move[enter_axis] > 0.0f ? -1.0f : 1.0f); }
+	return true;
 }
 
-bool Collision::testCollisionXYStrict(const Primitive& a, const Primitive& b)
+bool Collision::sweepAABB(const AABB& a, const glm::vec3& move, const std::vector<AABB>& boxes, const std::vector<uint32_t>& candidates,
+	float* t, glm::vec3* normal, uint32_t* index, const glm::vec3& facing)
 {
-	if (a.type == PrimitiveType::AABB && b.type == PrimitiveType::AABB)
+	bool found = false;
+	*t = std::numeric_limits<float>::infinity();
+	for (uint32_t i : candidates)
 	{
-		return testAABBAABBXYStrict(static_cast<const AABB&>(a), static_cast<const AABB&>(b));
+		float hit_t;
+		glm::vec3 hit_normal;
+		if (!sweepAABBAABB(a, move, boxes[i], &hit_t, &hit_normal)) { continue; }
+		if (hit_normal == glm::vec3(0.0f)) { continue; } // already touching at the start
+		if (facing != glm::vec3(0.0f) && glm::dot(hit_normal, facing) <= 0.0f) { continue; }
+		if (hit_t < *t)
+		{
+			found = true;
+			*t = hit_t;
+			*normal = hit_normal;
+			*index = i;
+		}
 	}
-	return false;	
-}
\ No newline at end of file
+	return found;
+}
+
+void Collision::UniformGrid::build(const std::vector<AABB>& boxes, float cell_size_)
+{
+	cell_start.clear();
+	cell_items.clear();
+	dims = glm::uvec2(0);
+	stamps.assign(boxes.size(), 0);
+	stamp = 0;
+	if (boxes.empty()) { return; }
+
+	// bounds of all boxes (and average footprint, for picking a cell size)
+	glm::vec2 lo = glm::vec2(std::numeric_limits<float>::infinity());
+	glm::vec2 hi = glm::vec2(-std::numeric_limits<float>::infinity());
+	float total_size = 0.0f;
+	for (const AABB& b : boxes)
+	{
+		lo = glm::min(lo, glm::vec2(b.c - b.r));
+		hi = glm::max(hi, glm::vec2(b.c + b.r));
+		total_size += 2.0f * std::max(b.r.x, b.r.y);
+	}
+	cell_size = (cell_size_ > 0.0f ? cell_size_ : std::max(0.5f, total_size / float(boxes.size())));
+	// keep the grid a reasonable size even for huge, sparse levels
+	const float max_cells = 512.0f;
+	cell_size = std::max(cell_size, std::max(hi.x - lo.x, hi.y - lo.y) / max_cells);
+	origin = lo;
+	dims = glm::uvec2(glm::floor((hi - lo) / cell_size)) + glm::uvec2(1);
+
+	auto cell_range = [this](const AABB& b, glm::uvec2* min, glm::uvec2* max) {
+		glm::vec2 a = (glm::vec2(b.c - b.r) - origin) / cell_size;
+		glm::vec2 z = (glm::vec2(b.c + b.r) - origin) / cell_size;
+		*min = glm::uvec2(glm::max(a, glm::vec2(0.0f)));
+		*max = glm::min(glm::uvec2(glm::max(z, glm::vec2(0.0f))), dims - glm::uvec2(1));
+	};
+
+	// counting sort of box indices into cells
+	cell_start.assign(dims.x * dims.y + 1, 0);
+	for (const AABB& b : boxes)
+	{
+		glm::uvec2 min, max;
+		cell_range(b, &min, &max);
+		for (uint32_t y = min.y; y <= max.y; ++y)
+			for (uint32_t x = min.x; x <= max.x; ++x)
+				cell_start[y * dims.x + x + 1] += 1;
+	}
+	for (size_t i = 1; i < cell_start.size(); ++i) { cell_start[i] += cell_start[i - 1]; }
+	cell_items.resize(cell_start.back());
+	std::vector<uint32_t> cursor(cell_start.begin(), cell_start.end() - 1);
+	for (uint32_t i = 0; i < boxes.size(); ++i)
+	{
+		glm::uvec2 min, max;
+		cell_range(boxes[i], &min, &max);
+		for (uint32_t y = min.y; y <= max.y; ++y)
+			for (uint32_t x = min.x; x <= max.x; ++x)
+				cell_items[cursor[y * dims.x + x]++] = i;
+	}
+}
+
+void Collision::UniformGrid::query(const AABB& box, float margin, std::vector<uint32_t>* candidates) const
+{
+	candidates->clear();
+	if (cell_items.empty()) { return; }
+
+	glm::vec2 a = (glm::vec2(box.c - box.r) - margin - origin) / cell_size;
+	glm::vec2 z = (glm::vec2(box.c + box.r) + margin - origin) / cell_size;
+	// entirely outside the grid?
+	if (z.x < 0.0f || z.y < 0.0f || a.x >= float(dims.x) || a.y >= float(dims.y)) { return; }
+	glm::uvec2 min = glm::uvec2(glm::max(a, glm::vec2(0.0f)));
+	glm::uvec2 max = glm::min(glm::uvec2(z), dims - glm::uvec2(1));
+
+	++stamp;
+	if (stamp == 0)
+	{
+		// stamp wrapped around; start over
+		std::fill(stamps.begin(), stamps.end(), 0);
+		stamp = 1;
+	}
+	for (uint32_t y = min.y; y <= max.y; ++y)
+	{
+		for (uint32_t x = min.x; x <= max.x; ++x)
+		{
+			uint32_t cell = y * dims.x + x;
+			for (uint32_t i = cell_start[cell]; i < cell_start[cell + 1]; ++i)
+			{
+				uint32_t item = cell_items[i];
+				if (stamps[item] == stamp) { continue; }
+				stamps[item] = stamp;
+				candidates->push_back(item);
+			}
+		}
+	}
+	// report in the same order as the original box list, so callers behave like a full scan
+	std::sort(candidates->begin(), candidates->end());
+}
+
+void Collision::HeightColumns::build(const std::vector<AABB>& boxes_, float cell_size)
+{
+	boxes = boxes_;
+	grid.build(boxes, cell_size);
+	for (uint32_t cell = 0; cell + 1 < grid.cell_start.size(); ++cell)
+	{
+		auto begin = grid.cell_items.begin() + grid.cell_start[cell];
+		auto end = grid.cell_items.begin() + grid.cell_start[cell + 1];
+		std::sort(begin, end, [this](uint32_t a, uint32_t b) {
+			return boxes[a].r.z + boxes[a].c.z < boxes[b].r.z + boxes[b].c.z;
+		});
+	}
+	tops.resize(grid.cell_items.size());
+	for (uint32_t i = 0; i < grid.cell_items.size(); ++i)
+	{
+		const AABB& b = boxes[grid.cell_items[i]];
+		tops[i] = b.r.z + b.c.z;
+	}
+}
+
+namespace
+{
+	// shared body of the HeightColumns queries: 'covers(box)' decides whether a box is under the query
+	template<typename Covers>
+	bool columns_top_below(const Collision::HeightColumns& columns, const glm::vec2& lo, const glm::vec2& hi, float z,
+		Covers const& covers, float* top, uint32_t* index)
+	{
+		const Collision::UniformGrid& grid = columns.grid;
+		if (grid.cell_items.empty()) { return false; }
+		glm::vec2 a = (lo - grid.origin) / grid.cell_size;
+		glm::vec2 b = (hi - grid.origin) / grid.cell_size;
+		if (b.x < 0.0f || b.y < 0.0f || a.x >= float(grid.dims.x) || a.y >= float(grid.dims.y)) { return false; }
+		glm::uvec2 min = glm::uvec2(glm::max(a, glm::vec2(0.0f)));
+		glm::uvec2 max = glm::min(glm::uvec2(b), grid.dims - glm::uvec2(1));
+
+		bool found = false;
+		for (uint32_t y = min.y; y <= max.y; ++y)
+		{
+			for (uint32_t x = min.x; x <= max.x; ++x)
+			{
+				uint32_t cell = y * grid.dims.x + x;
+				auto begin = columns.tops.begin() + grid.cell_start[cell];
+				auto end = columns.tops.begin() + grid.cell_start[cell + 1];
+				// first box in this cell whose top is above z; walk down from there to the first one that covers the query
+				auto it = std::upper_bound(begin, end, z);
+				while (it != begin)
+				{
+					--it;
+					if (found && *it <= *top) { break; } // can't beat what another cell already found
+					uint32_t item = grid.cell_items[it - columns.tops.begin()];
+					if (covers(columns.boxes[item]))
+					{
+						found = true;
+						*top = *it;
+						if (index) { *index = item; }
+						break;
+					}
+				}
+			}
+		}
+		return found;
+	}
+}
+
+bool Collision::HeightColumns::top_below(const AABB& footprint, float z, float* top, uint32_t* index) const
+{
+	return columns_top_below(*this, glm::vec2(footprint.c - footprint.r), glm::vec2(footprint.c + footprint.r), z,
+		[&footprint](const AABB& b) { return testAABBAABBXYStrict(b, footprint); }, top, index);
+}
+
+bool Collision::HeightColumns::top_below(const glm::vec3& point, float* top, uint32_t* index) const
+{
+	return columns_top_below(*this, glm::vec2(point), glm::vec2(point), point.z,
+		[&point](const AABB& b) { return std::abs(b.c.x - point.x) <= b.r.x && std::abs(b.c.y - point.y) <= b.r.y; }, top, index);
+}
+
+namespace
+{
+	Collision::AABB combine(const Collision::AABB& a, const Collision::AABB& b)
+	{
+		glm::vec3 lo = glm::min(a.c - a.r, b.c - b.r);
+		glm::vec3 hi = glm::max(a.c + a.r, b.c + b.r);
+		return Collision::AABB(0.5f * (lo + hi), 0.5f * (hi - lo));
+	}
+
+	// (proportional to) surface area, the insertion cost heuristic:
+	float area(const Collision::AABB& a)
+	{
+		return a.r.x * a.r.y + a.r.y * a.r.z + a.r.z * a.r.x;
+	}
+
+	bool contains(const Collision::AABB& outer, const Collision::AABB& inner)
+	{
+		glm::vec3 d = glm::abs(inner.c - outer.c) + inner.r;
+		return d.x <= outer.r.x && d.y <= outer.r.y && d.z <= outer.r.z;
+	}
+
+	bool overlaps(const Collision::AABB& a, const Collision::AABB& b)
+	{
+		glm::vec3 d = glm::abs(a.c - b.c);
+		return d.x <= a.r.x + b.r.x && d.y <= a.r.y + b.r.y && d.z <= a.r.z + b.r.z;
+	}
+}
+
+uint32_t Collision::AABBTree::insert(const AABB& box, uint32_t data)
+{
+	uint32_t proxy = allocate_node();
+	Node& node = nodes[proxy];
+	node.box = AABB(box.c, box.r + glm::vec3(margin));
+	node.data = data;
+	node.height = 0;
+	insert_leaf(proxy);
+	return proxy;
+}
+
+void Collision::AABBTree::remove(uint32_t proxy)
+{
+	assert(proxy < nodes.size() && nodes[proxy].leaf());
+	remove_leaf(proxy);
+	free_node(proxy);
+}
+
+bool Collision::AABBTree::move(uint32_t proxy, const AABB& box, const glm::vec3& displacement)
+{
+	assert(proxy < nodes.size() && nodes[proxy].leaf());
+	if (contains(nodes[proxy].box, box)) { return false; }
+
+	remove_leaf(proxy);
+	// fatten, and stretch toward where the box is heading so that steady motion doesn't reinsert every frame
+	AABB fat = AABB(box.c, box.r + glm::vec3(margin));
+	fat.c += 0.5f * displacement;
+	fat.r += 0.5f * glm::abs(displacement);
+	nodes[proxy].box = fat;
+	insert_leaf(proxy);
+	return true;
+}
+
+void Collision::AABBTree::clear()
+{
+	nodes.clear();
+	root = Null;
+	free_list = Null;
+}
+
+void Collision::AABBTree::query(const AABB& box, std::vector<uint32_t>* datas) const
+{
+	if (root == Null) { return; }
+	stack.clear();
+	stack.emplace_back(root);
+	while (!stack.empty())
+	{
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if (!overlaps(node.box, box)) { continue; }
+		if (node.leaf())
+		{
+			datas->emplace_back(node.data);
+		}
+		else
+		{
+			stack.emplace_back(node.left);
+			stack.emplace_back(node.right);
+		}
+	}
+}
+
+void Collision::AABBTree::query_pairs(std::vector<std::pair<uint32_t, uint32_t>>* pairs) const
+{
+	if (root == Null) { return; }
+	// each leaf queries the tree; reporting only proxy < other keeps each pair once
+	for (uint32_t leaf = 0; leaf < nodes.size(); ++leaf)
+	{
+		if (nodes[leaf].height != 0) { continue; } // (interior or free node)
+		const AABB& box = nodes[leaf].box;
+		stack.clear();
+		stack.emplace_back(root);
+		while (!stack.empty())
+		{
+			uint32_t index = stack.back();
+			stack.pop_back();
+			const Node& node = nodes[index];
+			if (!overlaps(node.box, box)) { continue; }
+			if (node.leaf())
+			{
+				if (leaf < index) { pairs->emplace_back(nodes[leaf].data, node.data); }
+			}
+			else
+			{
+				stack.emplace_back(node.left);
+				stack.emplace_back(node.right);
+			}
+		}
+	}
+}
+
+uint32_t Collision::AABBTree::allocate_node()
+{
+	uint32_t index;
+	if (free_list != Null)
+	{
+		index = free_list;
+		free_list = nodes[index].parent;
+	}
+	else
+	{
+		index = uint32_t(nodes.size());
+		nodes.emplace_back();
+	}
+	nodes[index] = Node();
+	return index;
+}
+
+void Collision::AABBTree::free_node(uint32_t index)
+{
+	nodes[index].parent = free_list;
+	nodes[index].height = -1;
+	free_list = index;
+}
+
+void Collision::AABBTree::insert_leaf(uint32_t leaf)
+{
+	if (root == Null)
+	{
+		root = leaf;
+		nodes[root].parent = Null;
+		return;
+	}
+
+	// walk down toward the cheapest sibling (surface area heuristic, as in Box2D's b2DynamicTree)
+	const AABB leaf_box = nodes[leaf].box;
+	uint32_t index = root;
+	while (!nodes[index].leaf())
+	{
+		const Node& node = nodes[index];
+		float node_area = area(node.box);
+		float combined_area = area(combine(node.box, leaf_box));
+		// cost of making a new parent for this node and the leaf:
+		float cost = 2.0f * combined_area;
+		// cost of pushing the leaf further down, which grows this node:
+		float inheritance = 2.0f * (combined_area - node_area);
+		auto child_cost = [&](uint32_t child) {
+			const Node& c = nodes[child];
+			float grown = area(combine(c.box, leaf_box));
+			return (c.leaf() ? grown : grown - area(c.box)) + inheritance;
+		};
+		float cost_left = child_cost(node.left);
+		float cost_right = child_cost(node.right);
+		if (cost < cost_left && cost < cost_right) { break; }
+		index = (cost_left < cost_right ? node.left : node.right);
+	}
+	uint32_t sibling = index;
+
+	// new parent for sibling and leaf
+	uint32_t old_parent = nodes[sibling].parent;
+	uint32_t new_parent = allocate_node();
+	nodes[new_parent].parent = old_parent;
+	nodes[new_parent].box = combine(leaf_box, nodes[sibling].box);
+	nodes[new_parent].height = nodes[sibling].height + 1;
+	nodes[new_parent].left = sibling;
+	nodes[new_parent].right = leaf;
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+	if (old_parent != Null)
+	{
+		if (nodes[old_parent].left == sibling) { nodes[old_parent].left = new_parent; }
+		else { nodes[old_parent].right = new_parent; }
+	}
+	else
+	{
+		root = new_parent;
+	}
+
+	refit_up(nodes[leaf].parent);
+}
+
+void Collision::AABBTree::remove_leaf(uint32_t leaf)
+{
+	if (leaf == root)
+	{
+		root = Null;
+		return;
+	}
+
+	uint32_t parent = nodes[leaf].parent;
+	uint32_t grand_parent = nodes[parent].parent;
+	uint32_t sibling = (nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left);
+
+	// the sibling takes the parent's place
+	if (grand_parent != Null)
+	{
+		if (nodes[grand_parent].left == parent) { nodes[grand_parent].left = sibling; }
+		else { nodes[grand_parent].right = sibling; }
+		nodes[sibling].parent = grand_parent;
+		free_node(parent);
+		refit_up(grand_parent);
+	}
+	else
+	{
+		root = sibling;
+		nodes[sibling].parent = Null;
+		free_node(parent);
+	}
+}
+
+void Collision::AABBTree::refit_up(uint32_t index)
+{
+	while (index != Null)
+	{
+		index = balance(index);
+		Node& node = nodes[index];
+		node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+		node.box = combine(nodes[node.left].box, nodes[node.right].box);
+		index = node.parent;
+	}
+}
+
+// if a's children differ in height by more than one, rotate the taller child up into a's place; returns the index now in that place
+uint32_t Collision::AABBTree::balance(uint32_t ia)
+{
+	Node& a = nodes[ia];
+	if (a.leaf() || a.height < 2) { return ia; }
+
+	uint32_t ib = a.left;
+	uint32_t ic = a.right;
+	Node& b = nodes[ib];
+	Node& c = nodes[ic];
+	int32_t difference = c.height - b.height;
+
+	// rotate c up
+	if (difference > 1)
+	{
+		uint32_t i_f = c.left;
+		uint32_t i_g = c.right;
+		Node& f = nodes[i_f];
+		Node& g = nodes[i_g];
+
+		c.left = ia;
+		c.parent = a.parent;
+		a.parent = ic;
+		if (c.parent != Null)
+		{
+			if (nodes[c.parent].left == ia) { nodes[c.parent].left = ic; }
+			else { nodes[c.parent].right = ic; }
+		}
+		else
+		{
+			root = ic;
+		}
+
+		// the taller of c's children stays with c, the other goes to a
+		if (f.height > g.height)
+		{
+			c.right = i_f;
+			a.right = i_g;
+			g.parent = ia;
+			a.box = combine(b.box, g.box);
+			c.box = combine(a.box, f.box);
+			a.height = 1 + std::max(b.height, g.height);
+			c.height = 1 + std::max(a.height, f.height);
+		}
+		else
+		{
+			c.right = i_g;
+			a.right = i_f;
+			f.parent = ia;
+			a.box = combine(b.box, f.box);
+			c.box = combine(a.box, g.box);
+			a.height = 1 + std::max(b.height, f.height);
+			c.height = 1 + std::max(a.height, g.height);
+		}
+		return ic;
+	}
+
+	// rotate b up
+	if (difference < -1)
+	{
+		uint32_t i_d = b.left;
+		uint32_t i_e = b.right;
+		Node& d = nodes[i_d];
+		Node& e = nodes[i_e];
+
+		b.left = ia;
+		b.parent = a.parent;
+		a.parent = ib;
+		if (b.parent != Null)
+		{
+			if (nodes[b.parent].left == ia) { nodes[b.parent].left = ib; }
+			else { nodes[b.parent].right = ib; }
+		}
+		else
+		{
+			root = ib;
+		}
+
+		if (d.height > e.height)
+		{
+			b.right = i_d;
+			a.left = i_e;
+			e.parent = ia;
+			a.box = combine(c.box, e.box);
+			b.box = combine(a.box, d.box);
+			a.height = 1 + std::max(c.height, e.height);
+			b.height = 1 + std::max(a.height, d.height);
+		}
+		else
+		{
+			b.right = i_e;
+			a.left = i_d;
+			d.parent = ia;
+			a.box = combine(c.box, d.box);
+			b.box = combine(a.box, e.box);
+			a.height = 1 + std::max(c.height, d.height);
+			b.height = 1 + std::max(a.height, e.height);
+		}
+		return ib;
+	}
+
+	return ia;
+}
+
+void Collision::AABBSet::clear()
+{
+	count = 0;
+	cx.clear(); cy.clear(); cz.clear();
+	rx.clear(); ry.clear(); rz.clear();
+}
+
+void Collision::AABBSet::push_back(const AABB& box)
+{
+	if (count == cx.size())
+	{
+		// grow by a whole block of padding boxes; a radius of -infinity never overlaps anything
+		const float never = -std::numeric_limits<float>::infinity();
+		size_t size = cx.size() + Padding;
+		cx.resize(size, 0.0f); cy.resize(size, 0.0f); cz.resize(size, 0.0f);
+		rx.resize(size, never); ry.resize(size, never); rz.resize(size, never);
+	}
+	set(count, box);
+	++count;
+}
+
+void Collision::AABBSet::set(uint32_t i, const AABB& box)
+{
+	cx[i] = box.c.x; cy[i] = box.c.y; cz[i] = box.c.z;
+	rx[i] = box.r.x; ry[i] = box.r.y; rz[i] = box.r.z;
+}
+
+Collision::AABB Collision::AABBSet::get(uint32_t i) const
+{
+	return AABB(glm::vec3(cx[i], cy[i], cz[i]), glm::vec3(rx[i], ry[i], rz[i]));
+}
+
+namespace
+{
+	enum KernelMode { Full, XY, XYStrict };
+
+	// shared body of the AABBSet kernels; uses exactly the same arithmetic as the scalar tests above
+	// so results match bit-for-bit (set[i] plays 'a', query box plays 'b')
+	template<KernelMode Mode>
+	void test_set(const Collision::AABBSet& set, const Collision::AABB& b, std::vector<uint32_t>* hits, std::vector<uint32_t>* x_side)
+	{
+		const uint32_t n = uint32_t(set.cx.size());
+		hits->assign((n + 31) / 32, 0);
+		x_side->assign((n + 31) / 32, 0);
+
+#ifdef COLLISION_USE_SSE
+		const __m128 sign = _mm_set1_ps(-0.0f);
+		const __m128 tol = _mm_set1_ps(0.2f);
+		const __m128 bcx = _mm_set1_ps(b.c.x), bcy = _mm_set1_ps(b.c.y), bcz = _mm_set1_ps(b.c.z);
+		const __m128 brx = _mm_set1_ps(b.r.x), bry = _mm_set1_ps(b.r.y), brz = _mm_set1_ps(b.r.z);
+		const __m128 b_lo_x = _mm_sub_ps(bcx, brx), b_hi_x = _mm_add_ps(bcx, brx);
+		const __m128 b_lo_y = _mm_sub_ps(bcy, bry), b_hi_y = _mm_add_ps(bcy, bry);
+		for (uint32_t i = 0; i < n; i += 4)
+		{
+			__m128 acx = _mm_loadu_ps(&set.cx[i]), acy = _mm_loadu_ps(&set.cy[i]);
+			__m128 arx = _mm_loadu_ps(&set.rx[i]), ary = _mm_loadu_ps(&set.ry[i]);
+
+			__m128 sx = _mm_add_ps(arx, brx);
+			__m128 sy = _mm_add_ps(ary, bry);
+			if (Mode == XY) { sx = _mm_add_ps(sx, tol); sy = _mm_add_ps(sy, tol); }
+			if (Mode == XYStrict) { sx = _mm_sub_ps(sx, tol); sy = _mm_sub_ps(sy, tol); }
+			__m128 hit = _mm_and_ps(
+				_mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(acx, bcx)), sx),
+				_mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(acy, bcy)), sy));
+			if (Mode == Full)
+			{
+				__m128 acz = _mm_loadu_ps(&set.cz[i]), arz = _mm_loadu_ps(&set.rz[i]);
+				hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(acz, bcz)), _mm_add_ps(arz, brz)));
+			}
+			int hit_bits = _mm_movemask_ps(hit);
+			if (hit_bits == 0) { continue; }
+
+			// side classification, as in testAABBAABB
+			__m128 dist_x = _mm_min_ps(
+				_mm_andnot_ps(sign, _mm_sub_ps(_mm_add_ps(acx, arx), b_lo_x)),
+				_mm_andnot_ps(sign, _mm_sub_ps(_mm_sub_ps(acx, arx), b_hi_x)));
+			__m128 dist_y = _mm_min_ps(
+				_mm_andnot_ps(sign, _mm_sub_ps(_mm_add_ps(acy, ary), b_lo_y)),
+				_mm_andnot_ps(sign, _mm_sub_ps(_mm_sub_ps(acy, ary), b_hi_y)));
+			int side_bits = _mm_movemask_ps(_mm_cmplt_ps(dist_x, dist_y)) & hit_bits;
+
+			(*hits)[i / 32] |= uint32_t(hit_bits) << (i % 32);
+			(*x_side)[i / 32] |= uint32_t(side_bits) << (i % 32);
+		}
+#else
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			float sx = set.rx[i] + b.r.x;
+			float sy = set.ry[i] + b.r.y;
+			if (Mode == XY) { sx = sx + 0.2f; sy = sy + 0.2f; }
+			if (Mode == XYStrict) { sx = sx - 0.2f; sy = sy - 0.2f; }
+			bool hit = std::abs(set.cx[i] - b.c.x) <= sx && std::abs(set.cy[i] - b.c.y) <= sy;
+			if (Mode == Full) { hit = hit && std::abs(set.cz[i] - b.c.z) <= set.rz[i] + b.r.z; }
+			if (!hit) { continue; }
+
+			float dist_x = std::min(std::abs((set.cx[i] + set.rx[i]) - (b.c.x - b.r.x)), std::abs((set.cx[i] - set.rx[i]) - (b.c.x + b.r.x)));
+			float dist_y = std::min(std::abs((set.cy[i] + set.ry[i]) - (b.c.y - b.r.y)), std::abs((set.cy[i] - set.ry[i]) - (b.c.y + b.r.y)));
+			(*hits)[i / 32] |= 1u << (i % 32);
+			if (dist_x < dist_y) { (*x_side)[i / 32] |= 1u << (i % 32); }
+		}
+#endif
+	}
+}
+
+void Collision::AABBSet::testAABB(const AABB& box, std::vector<uint32_t>* hits, std::vector<uint32_t>* x_side) const
+{
+	test_set<Full>(*this, box, hits, x_side);
+}
+
+void Collision::AABBSet::testAABBXY(const AABB& box, std::vector<uint32_t>* hits, std::vector<uint32_t>* x_side) const
+{
+	test_set<XY>(*this, box, hits, x_side);
+}
+
+void Collision::AABBSet::testAABBXYStrict(const AABB& box, std::vector<uint32_t>* hits, std::vector<uint32_t>* x_side) const
+{
+	test_set<XYStrict>(*this, box, hits, x_side);
+}
+
+void Collision::AABBSet::testOBB(const OBB& box, std::vector<uint32_t>* hits) const
+{
+	const uint32_t n = uint32_t(cx.size());
+	hits->assign((n + 31) / 32, 0);
+	OBBQuery q(box);
+
+#ifdef COLLISION_USE_SSE
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	auto splat = [](float f) { return _mm_set1_ps(f); };
+	auto abs4 = [&](__m128 v) { return _mm_andnot_ps(sign, v); };
+	for (uint32_t i = 0; i < n; i += 4)
+	{
+		__m128 br[3] = { _mm_loadu_ps(&rx[i]), _mm_loadu_ps(&ry[i]), _mm_loadu_ps(&rz[i]) };
+		__m128 tw[3] = {
+			_mm_sub_ps(_mm_loadu_ps(&cx[i]), splat(q.c.x)),
+			_mm_sub_ps(_mm_loadu_ps(&cy[i]), splat(q.c.y)),
+			_mm_sub_ps(_mm_loadu_ps(&cz[i]), splat(q.c.z)) };
+
+		// same axis order as test_query_aabb; give up on a group of four once all are separated
+		__m128 inside = _mm_cmple_ps(abs4(tw[0]), _mm_add_ps(splat(q.r_world.x), br[0]));
+		inside = _mm_and_ps(inside, _mm_cmple_ps(abs4(tw[1]), _mm_add_ps(splat(q.r_world.y), br[1])));
+		inside = _mm_and_ps(inside, _mm_cmple_ps(abs4(tw[2]), _mm_add_ps(splat(q.r_world.z), br[2])));
+		if (_mm_movemask_ps(inside) == 0) { continue; }
+
+		__m128 t[3];
+		for (int a = 0; a < 3; ++a)
+		{
+			t[a] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(splat(q.R[a][0]), tw[0]), _mm_mul_ps(splat(q.R[a][1]), tw[1])), _mm_mul_ps(splat(q.R[a][2]), tw[2]));
+			__m128 rb = _mm_add_ps(_mm_add_ps(_mm_mul_ps(br[0], splat(q.AbsR[a][0])), _mm_mul_ps(br[1], splat(q.AbsR[a][1]))), _mm_mul_ps(br[2], splat(q.AbsR[a][2])));
+			inside = _mm_and_ps(inside, _mm_cmple_ps(abs4(t[a]), _mm_add_ps(splat(q.e[a]), rb)));
+		}
+		if (_mm_movemask_ps(inside) == 0) { continue; }
+
+		for (int a = 0; a < 3; ++a)
+		{
+			int a1 = (a + 1) % 3, a2 = (a + 2) % 3;
+			for (int k = 0; k < 3; ++k)
+			{
+				int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+				float ra = q.e[a1] * q.AbsR[a2][k] + q.e[a2] * q.AbsR[a1][k];
+				__m128 rb = _mm_add_ps(_mm_mul_ps(br[k1], splat(q.AbsR[a][k2])), _mm_mul_ps(br[k2], splat(q.AbsR[a][k1])));
+				__m128 dist = abs4(_mm_sub_ps(_mm_mul_ps(t[a2], splat(q.R[a1][k])), _mm_mul_ps(t[a1], splat(q.R[a2][k]))));
+				inside = _mm_and_ps(inside, _mm_cmple_ps(dist, _mm_add_ps(splat(ra), rb)));
+			}
+		}
+		(*hits)[i / 32] |= uint32_t(_mm_movemask_ps(inside)) << (i % 32);
+	}
+#else
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (test_query_aabb(q, glm::vec3(cx[i], cy[i], cz[i]), glm::vec3(rx[i], ry[i], rz[i])))
+		{
+			(*hits)[i / 32] |= 1u << (i % 32);
+		}
+	}
+#endif
+}
@@ -15,6 +15,9 @@
 
 #include <glm/glm.hpp>
 #include <cmath>        // std::abs
+#include <vector>
+#include <utility>
+#include <cstdint>
 
 namespace Collision
 {
@@ -39,8 +42,33 @@ namespace Collision
 		glm::vec3 r; // radius in x,y,z direction
 	};
 
+	// oriented bounding box
+	struct OBB : Primitive
+	{
+		OBB() = default;
+		OBB(glm::vec3 c_, glm::mat3 u_, glm::vec3 e_) : Primitive(PrimitiveType::OBB), c(c_), u(u_), e(e_) {}
+		// box around local-space bounds (e.g. Mesh::min/max) placed by a local-to-world transform
+		// (e.g. drawable.transform->make_local_to_world()); scale is folded into the extents:
+		static OBB from_bounds(const glm::vec3& min, const glm::vec3& max, const glm::mat4x3& local_to_world);
+		glm::vec3 c; // center
+		glm::mat3 u; // local axes (columns, unit length)
+		glm::vec3 e; // half extents along each local axis
+	};
+
+	// world-space AABB enclosing an OBB (for broadphase structures like UniformGrid):
+	AABB boundsOBB(const OBB& a);
+
 	int testAABBAABB(const AABB& a, const AABB& b);
 
+	// separating axis tests (face axes of each box first, then the nine edge-edge axes):
+	bool testOBBOBB(const OBB& a, const OBB& b);
+	bool testOBBAABB(const OBB& a, const AABB& b);
+
+	// batched versions: append to *hits the indices (from 'candidates') of boxes that overlap 'a'
+	// (values derived from 'a' alone are only computed once per call)
+	void testOBBOBBs(const OBB& a, const std::vector<OBB>& boxes, const std::vector<uint32_t>& candidates, std::vector<uint32_t>* hits);
+	void testOBBAABBs(const OBB& a, const std::vector<AABB>& boxes, const std::vector<uint32_t>& candidates, std::vector<uint32_t>* hits);
+
 	// this function only checks for overlapping in X and Y direction
 	bool testAABBAABBXY(const AABB& a, const AABB& b);
 	bool testAABBAABBXYStrict(const AABB& a, const AABB& b);
@@ -49,6 +77,152 @@ namespace Collision
 
 	bool testCollisionXY(const Primitive& a, const Primitive& b);
 	bool testCollisionXYStrict(const Primitive& a, const Primitive& b);
+
+	// continuous collision: box 'a' moves by 'move' over the frame, box 'b' stays still
+	// returns true if they touch at some time t in [0,1]:
+	//  - *t gets the first time of contact (a.c + t * move)
+	//  - *normal gets the contact normal on b's face (pointing toward a), e.g. (0,0,1) when landing on top of b
+	//  - if the boxes already overlap at t = 0, *t is 0 and *normal is (0,0,0)
+	// example:
+	// float t; glm::vec3 n;
+	// if (Collision::sweepAABBAABB(player_box, velocity * elapsed, platform, &t, &n) && n.z > 0.0f) { /* landed at t */ }
+	bool sweepAABBAABB(const AABB& a, const glm::vec3& move, const AABB& b, float* t, glm::vec3* normal);
+
+	// the box (of boxes[candidates[...]]) hit first by 'a' moving by 'move'
+	// boxes that 'a' already overlaps at t = 0 are skipped, so resting contacts don't block sliding away
+	// if 'facing' is nonzero, only contacts whose normal points along it count (e.g. (0,0,1): landings only),
+	//  so a side contact in front doesn't hide the surface behind it
+	// returns false if nothing is hit; otherwise *index is an index into 'boxes'
+	bool sweepAABB(const AABB& a, const glm::vec3& move, const std::vector<AABB>& boxes, const std::vector<uint32_t>& candidates,
+		float* t, glm::vec3* normal, uint32_t* index, const glm::vec3& facing = glm::vec3(0.0f));
+
+	// structure-of-arrays box set, for testing one box against many at once with SIMD
+	// (the kernels give the same answers as testAABBAABB / testAABBAABBXY / testAABBAABBXYStrict,
+	//  with each set box as 'a' and the query box as 'b')
+	// example:
+	// Collision::AABBSet set; for (auto& p : obstacles) set.push_back(p);
+	// set.testAABB(player_box, &hits, &x_side);
+	// if (hits[i / 32] & (1u << (i % 32))) { /* obstacle i collides; in x if x_side bit is also set, otherwise in y */ }
+	struct AABBSet
+	{
+		void clear();
+		void push_back(const AABB& box);
+		void set(uint32_t i, const AABB& box);
+		AABB get(uint32_t i) const;
+		uint32_t size() const { return count; }
+
+		// fill 'hits' with one bit per box (bit i % 32 of word i / 32), and 'x_side' with whether
+		// each hit is a collision in x (testAABBAABB returning 1) rather than y (returning 2)
+		void testAABB(const AABB& box, std::vector<uint32_t>* hits, std::vector<uint32_t>* x_side) const;
+		void testAABBXY(const AABB& box, std::vector<uint32_t>* hits, std::vector<uint32_t>* x_side) const;
+		void testAABBXYStrict(const AABB& box, std::vector<uint32_t>* hits, std::vector<uint32_t>* x_side) const;
+		// same as testOBBAABB against every box; 'hits' gets one bit per box as above
+		void testOBB(const OBB& box, std::vector<uint32_t>* hits) const;
+
+		// arrays are padded to a multiple of Padding with boxes that never collide
+		enum : uint32_t { Padding = 8 };
+		uint32_t count = 0;
+		std::vector<float> cx, cy, cz; // centers
+		std::vector<float> rx, ry, rz; // radii
+	};
+
+	// broadphase: dynamic AABB tree, for boxes that move, appear, or disappear during play
+	// each leaf stores a "fat" box (the real box grown by 'margin'), so small moves don't touch the tree at all;
+	// when a box leaves its fat box it is removed and reinserted (with the tree kept balanced by rotations).
+	// example:
+	// Collision::AABBTree tree;
+	// uint32_t proxy = tree.insert(shark_box, SharkId);
+	// tree.move(proxy, shark_box, shark_box.c - old_center); // each frame
+	// tree.query(player_box, &ids); // ids of boxes whose fat boxes overlap player_box -- still run a narrow-phase test
+	// tree.remove(proxy);
+	struct AABBTree
+	{
+		enum : uint32_t { Null = -1U };
+
+		// add a box carrying 'data' (returned by queries); returns a proxy id for move / remove:
+		uint32_t insert(const AABB& box, uint32_t data);
+		void remove(uint32_t proxy);
+		// update a proxy's box; 'displacement' (this frame's motion, if known) stretches the fat box in the direction of travel
+		// returns true if the proxy had to be reinserted
+		bool move(uint32_t proxy, const AABB& box, const glm::vec3& displacement = glm::vec3(0.0f));
+		void clear();
+
+		// append 'data' of every proxy whose fat box overlaps 'box':
+		void query(const AABB& box, std::vector<uint32_t>* datas) const;
+		// append (data, data) for every pair of proxies whose fat boxes overlap:
+		void query_pairs(std::vector<std::pair<uint32_t, uint32_t>>* pairs) const;
+
+		const AABB& fat_box(uint32_t proxy) const { return nodes[proxy].box; }
+		uint32_t data(uint32_t proxy) const { return nodes[proxy].data; }
+
+		float margin = 0.1f;
+
+		// internals:
+		struct Node
+		{
+			AABB box;
+			uint32_t parent = Null; // (next free node, for nodes on the free list)
+			uint32_t left = Null;
+			uint32_t right = Null;
+			int32_t height = 0;     // leaves are 0, free nodes are -1
+			uint32_t data = 0;
+			bool leaf() const { return left == Null; }
+		};
+		std::vector<Node> nodes;
+		uint32_t root = Null;
+		uint32_t free_list = Null;
+		mutable std::vector<uint32_t> stack; // scratch space for traversals
+
+		uint32_t allocate_node();
+		void free_node(uint32_t index);
+		void insert_leaf(uint32_t leaf);
+		void remove_leaf(uint32_t leaf);
+		uint32_t balance(uint32_t index);
+		void refit_up(uint32_t index);
+	};
+
+	// broadphase: uniform grid (in x and y) over a fixed set of boxes
+	// query() returns the (sorted) indices of boxes that might overlap the query box;
+	// callers still run the narrow-phase test (testCollision etc.) on each candidate.
+	// example:
+	// Collision::UniformGrid grid; grid.build(obstacles);
+	// grid.query(player_box, 0.2f, &candidates);
+	// for (uint32_t i : candidates) { if (Collision::testCollision(obstacles[i], player_box)) { ... } }
+	struct UniformGrid
+	{
+		// cell_size <= 0 picks one from the average box size:
+		void build(const std::vector<AABB>& boxes, float cell_size = 0.0f);
+		// margin grows the query box in x and y (e.g. 0.2f to cover testAABBAABBXY's tolerance):
+		void query(const AABB& box, float margin, std::vector<uint32_t>* candidates) const;
+
+		glm::vec2 origin = glm::vec2(0.0f);
+		float cell_size = 1.0f;
+		glm::uvec2 dims = glm::uvec2(0);
+		std::vector<uint32_t> cell_start; // cell i holds cell_items[cell_start[i], cell_start[i+1])
+		std::vector<uint32_t> cell_items;
+		// used to report each box once per query:
+		mutable std::vector<uint32_t> stamps;
+		mutable uint32_t stamp = 0;
+	};
+
+	// "what's the highest surface under here?" over a fixed set of boxes:
+	// boxes are bucketed into xy cells (a UniformGrid) and each cell's boxes are sorted by top (c.z + r.z),
+	// so a query is a binary search per covered cell instead of a scan over every box.
+	// example:
+	// Collision::HeightColumns columns; columns.build(obstacles);
+	// float top; if (columns.top_below(player_box, player_z, &top)) { shadow_z = top; }
+	struct HeightColumns
+	{
+		void build(const std::vector<AABB>& boxes, float cell_size = 0.0f);
+		// highest top at or below 'z' among boxes b with testAABBAABBXYStrict(b, footprint):
+		bool top_below(const AABB& footprint, float z, float* top, uint32_t* index = nullptr) const;
+		// highest top at or below point.z among boxes whose xy footprint contains point:
+		bool top_below(const glm::vec3& point, float* top, uint32_t* index = nullptr) const;
+
+		std::vector<AABB> boxes;
+		UniformGrid grid;        // cell_items sorted by top within each cell
+		std::vector<float> tops; // top of grid.cell_items[i]
+	};
 }
 
 
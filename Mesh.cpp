@@ -11,7 +11,7 @@
 #include <set>
 #include <cstddef>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
+MeshBuffer::MeshBuffer(std::string const &filename, std::function< bool(std::string const &) > const &keep_positions) {
 	glGenBuffers(1, &buffer);
 
 	std::ifstream file(filename, std::ios::binary);
@@ -110,6 +110,12 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
+			} else if (keep_positions && keep_positions(name)) {
+				std::vector< glm::vec3 > &kept = positions[name];
+				kept.reserve(mesh.count);
+				for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+					kept.emplace_back(data_mod[v].Position_3D);
+				}
 			}
 		}
 	}
@@ -14,6 +14,8 @@
 #include <map>
 #include <limits>
 #include <string>
+#include <vector>
+#include <functional>
 
 
 struct Mesh {
@@ -32,7 +34,8 @@ struct Mesh {
 struct MeshBuffer {
 	//construct from a file:
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	//keep_positions (optional) picks meshes (by name) whose world-space triangles should stay in memory (see 'positions', below):
+	MeshBuffer(std::string const &filename, std::function< bool(std::string const &) > const &keep_positions = nullptr);
 
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
@@ -50,6 +53,10 @@ struct MeshBuffer {
 	//used by the lookup() function:
 	std::map< std::string, Mesh > meshes;
 
+	//CPU-side copies of the (Position_3D) triangles of meshes picked by keep_positions, three vertices per triangle:
+	// (e.g., for building Collision::TriangleBVH's)
+	std::map< std::string, std::vector< glm::vec3 > > positions;
+
 	//These 'Attrib' structures describe the location of various attributes within the buffer (in exactly format wanted by glVertexAttribPointer). They are set when the file is loaded and are used by the "make_vao_for_program" call:
 	struct Attrib {
 		GLint size = 0;
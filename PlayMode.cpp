@@ -16,6 +16,7 @@
 
 #include "BoneAnimation.hpp"
 
+#include <algorithm>
 #include <random>
 
 GLuint phonebank_meshes_for_lit_color_texture_program = 0;
@@ -27,28 +28,33 @@ GLuint vertex_buffer_for_color_texture_program = 0;
 GLuint vertex_buffer = 0;
 GLuint white_tex = 0;
 
+//obstacle ("o_") meshes keep their triangles in memory for triangle-accurate collision:
+static bool is_obstacle_mesh(std::string const &name) {
+	return name.find("o_") != std::string::npos;
+}
+
 Load< MeshBuffer > phonebank_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("level1.pnct"));
+	MeshBuffer const *ret = new MeshBuffer(data_path("level1.pnct"), is_obstacle_mesh);
 	phonebank_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
 	return ret;
 });
 Load< MeshBuffer > chase1_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("chase1.pnct"));
+	MeshBuffer const *ret = new MeshBuffer(data_path("chase1.pnct"), is_obstacle_mesh);
 	chase1_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
 	return ret;
 });
 Load< MeshBuffer > level2_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("level2.pnct"));
+	MeshBuffer const *ret = new MeshBuffer(data_path("level2.pnct"), is_obstacle_mesh);
 	level2_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
 	return ret;
 });
 Load< MeshBuffer > level3_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("level3.pnct"));
+	MeshBuffer const *ret = new MeshBuffer(data_path("level3.pnct"), is_obstacle_mesh);
 	level3_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
 	return ret;
 });
 Load< MeshBuffer > chasef_meshes(LoadTagDefault, []() -> MeshBuffer const* {
-	MeshBuffer const* ret = new MeshBuffer(data_path("chasef.pnct"));
+	MeshBuffer const* ret = new MeshBuffer(data_path("chasef.pnct"), is_obstacle_mesh);
 	chasef_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
 	return ret;
 });
@@ -133,20 +139,13 @@ Load< Scene > chasef_scene(LoadTagDefault, []() -> Scene const* {
 });
 
 WalkMesh const *walkmesh_tutorial_level1 = nullptr;
-WalkMesh const *walkmesh_chase1 = nullptr;
 WalkMesh const *walkmesh_level2 = nullptr;
 WalkMesh const *walkmesh_level3 = nullptr;
-WalkMesh const* walkmesh_chasef = nullptr;
 Load< WalkMeshes > phonebank_walkmeshes(LoadTagDefault, []() -> WalkMeshes const * {
 	WalkMeshes *ret = new WalkMeshes(data_path("level1.w"));
 	walkmesh_tutorial_level1 = &ret->lookup("WalkMesh");
 	return ret;
 });
-Load< WalkMeshes > chase1_walkmeshes(LoadTagDefault, []() -> WalkMeshes const * {
-	WalkMeshes *ret = new WalkMeshes(data_path("chase1.w"));
-	walkmesh_chase1 = &ret->lookup("WalkMesh.001");
-	return ret;
-});
 Load< WalkMeshes> level2_walkmeshes(LoadTagDefault, []() -> WalkMeshes const * {
 	WalkMeshes *ret = new WalkMeshes(data_path("level2.w"));
 	walkmesh_level2 = &ret->lookup("Plane.025");
@@ -157,10 +156,16 @@ Load< WalkMeshes> level3_walkmeshes(LoadTagDefault, []() -> WalkMeshes const * {
 	walkmesh_level3 = &ret->lookup("Plane.001");
 	return ret;
 });
-Load< WalkMeshes > chasef_walkmeshes(LoadTagDefault, []() -> WalkMeshes const* {
-	WalkMeshes* ret = new WalkMeshes(data_path("chasef.w"));
-	walkmesh_chasef = &ret->lookup("WalkMesh");
-	return ret;
+//the chase levels are long, so they are walked in tiles instead (made from chase1.w / chasef.w by walkmesh-tile):
+TiledWalkMesh *tiled_walkmesh_chase1 = nullptr;
+TiledWalkMesh *tiled_walkmesh_chasef = nullptr;
+Load< TiledWalkMesh > chase1_tiled_walkmesh(LoadTagDefault, []() -> TiledWalkMesh const * {
+	tiled_walkmesh_chase1 = new TiledWalkMesh(data_path("chase1.wt"));
+	return tiled_walkmesh_chase1;
+});
+Load< TiledWalkMesh > chasef_tiled_walkmesh(LoadTagDefault, []() -> TiledWalkMesh const * {
+	tiled_walkmesh_chasef = new TiledWalkMesh(data_path("chasef.wt"));
+	return tiled_walkmesh_chasef;
 });
 
 BoneAnimation::Animation const* player_anim_jump = nullptr;
@@ -172,7 +177,6 @@ Load< BoneAnimation > level1_banims(LoadTagDefault, []() {
 	player_anim_jump = &(ret->lookup("Jump!local"));
 	player_anim_walk = &(ret->lookup("Walk!local"));
 	player_anim_climb = &(ret->lookup("Climb!local"));
-
 	return ret;
 });
 
@@ -192,16 +196,25 @@ Load< Sound::Sample > collect_sample(LoadTagDefault, []() -> Sound::Sample const
 	return new Sound::Sample(data_path("collect.wav"));
 });
 
-Load< Sound::Sample > jazz_sample(LoadTagDefault, []() -> Sound::Sample const* {
-	return new Sound::Sample(data_path("acid-trumpet-kevin-macleod.wav"));
+//(music is streamed while it plays rather than decoded up front, and is never dropped in favor of sound effects)
+static constexpr float MusicPriority = 100.0f;
+
+Load< Sound::StreamingSample > jazz_sample(LoadTagDefault, []() -> Sound::StreamingSample const* {
+	Sound::StreamingSample *ret = new Sound::StreamingSample(data_path("acid-trumpet-kevin-macleod.wav"));
+	ret->priority = MusicPriority;
+	return ret;
 });
 
-Load< Sound::Sample > chase_sample(LoadTagDefault, []() -> Sound::Sample const* {
-	return new Sound::Sample(data_path("raving-energy-faster-kevin-macleod.wav"));
+Load< Sound::StreamingSample > chase_sample(LoadTagDefault, []() -> Sound::StreamingSample const* {
+	Sound::StreamingSample *ret = new Sound::StreamingSample(data_path("raving-energy-faster-kevin-macleod.wav"));
+	ret->priority = MusicPriority;
+	return ret;
 });
 
-Load< Sound::Sample > scary_sample(LoadTagDefault, []() -> Sound::Sample const* {
-	return new Sound::Sample(data_path("wretched-destroyer-kevin-macleod.wav"));
+Load< Sound::StreamingSample > scary_sample(LoadTagDefault, []() -> Sound::StreamingSample const* {
+	Sound::StreamingSample *ret = new Sound::StreamingSample(data_path("wretched-destroyer-kevin-macleod.wav"));
+	ret->priority = MusicPriority;
+	return ret;
 });
 
 
@@ -212,7 +225,7 @@ void PlayMode::update_camera() {
 		player.camera->transform->position.y = std::sin(yaw) * camera_dist + player.transform->position.y;
 		player.camera->transform->position.z = std::sin(pitch) * camera_dist + player.transform->position.z + look_offset.z;
 
-		glm::vec3 up = walkmesh->to_world_smooth_normal(player.at);
+		glm::vec3 up = walk_surface().to_world_smooth_normal(player.at);
 		glm::mat4x3 frame = player.camera->transform->make_local_to_world();
 		glm::vec3 pos = frame[3];
 		glm::mat4 view = glm::lookAt(pos, player.transform->position + look_offset, up);
@@ -523,7 +536,7 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 				evt.motion.xrel / float(window_size.y),
 				-evt.motion.yrel / float(window_size.y)
 			);
-			glm::vec3 up = walkmesh->to_world_smooth_normal(player.at);
+			glm::vec3 up = walk_surface().to_world_smooth_normal(player.at);
 
 			player.transform->rotation = glm::angleAxis(-motion.x * player.camera->fovy, up) * player.transform->rotation;
 
@@ -555,6 +568,12 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 void PlayMode::update(float elapsed) {
 	if (!game_over)	game_timer += elapsed;
 
+	//keep the walkmesh tiles around the player loaded:
+	if (tiled_walkmesh) tiled_walkmesh->update_resident(player.transform->position, WalkTileRadius);
+
+	//free what any stopped sounds (e.g. music streams) were holding:
+	Sound::update();
+
 	if (game_state == PROLOGUE) {
 		if (((uint32_t) prologue_message) < prologue_messages.size()) return;
 		game_state = CUTSCENE;
@@ -586,7 +605,7 @@ void PlayMode::update(float elapsed) {
 			game_state = CUTSCENE;
 			ingredients_collected = 0;
 			view_scene = views::KITCHEN1;
-			background_loop->stop();
+			background_loop.stop();
 			background_loop = Sound::loop(*jazz_sample, 0.35f, 0.0f);
 		}
 	}
@@ -624,12 +643,12 @@ void PlayMode::update(float elapsed) {
 		}
 
 		// 3: add a second delay for dramatic effect and switch scene
-		if (shark_timer > 5.5f && walkmesh != walkmesh_chase1)
+		if (shark_timer > 5.5f && tiled_walkmesh != tiled_walkmesh_chase1)
 		{
-			switch_scene((Scene &) *chase1_scene, (MeshBuffer &) *chase1_meshes, walkmesh_chase1);
+			switch_scene((Scene &) *chase1_scene, (MeshBuffer &) *chase1_meshes, nullptr);
 			view_scene = views::SHARK_APPROACH;
 			jump_up_velocity = jump_speed;
-			background_loop->stop();
+			background_loop.stop();
 			background_loop = Sound::loop(*chase_sample, 0.4f, 0.0f);
 		}
 
@@ -646,10 +665,8 @@ void PlayMode::update(float elapsed) {
 
 			player_animations[0].position += elapsed;
 			player_animations[0].update(elapsed);
-			BoneAnimationPlayer* anim_player = &player_animations[0];
-			player_drawable->pipeline.set_uniforms = [anim_player]() {
-				anim_player->set_uniform(bone_vertex_color_program->bones_mat4x3_array);
-			};
+			player_mixer.crossfade(&player_animations[0], PlayerAnimationFade);
+			player_mixer.update(elapsed);
 		}
 
 		if (shark_timer > 6.5f)
@@ -670,12 +687,12 @@ void PlayMode::update(float elapsed) {
 		} else {
 			if (((uint32_t) revelation_message) >= revelation_messages.size()) {
 				game_state = FINAL;
-				switch_scene((Scene &)*chasef_scene, (MeshBuffer &)*chasef_meshes, walkmesh_chasef);
+				switch_scene((Scene &)*chasef_scene, (MeshBuffer &)*chasef_meshes, nullptr);
 				view_scene = views::PLAYER;
 				cinematic = false;
 				cinematic_edge_width = 0.0f;
 				chasing = true;
-				background_loop->stop();
+				background_loop.stop();
 				background_loop = Sound::loop(*scary_sample, 0.4f, 0.0f);
 				return;
 			}
@@ -909,13 +926,21 @@ void PlayMode::update(float elapsed) {
 		player_box.c.z += player_box.r.z - 0.001f; // hardcode z-offset because in blender frame is at bottom
 		bool reset_pos = false;
 
+		// long frames at high fall speeds can skip right over thin platforms, so sweep the fall first:
+		if (in_air && !climbing && jump_up_velocity < 0.0f) {
+			sweep_fall(player.transform->position, &temp_pos, &player_box);
+		}
+
 		// collision checking
 		if (!climbing) { // if we are climbing, we are essentially holding onto an obstacle and have no need to detect collision
 			bool collision = false;
 			can_climb = false;
-			for (Collision::AABB& p : obstacles)
+			for (uint32_t i : obstacle_candidates(player_box, 0.2f))
 			{
+				Collision::AABB& p = obstacles[i];
 				int collision_x_or_y = Collision::testCollision(p, player_box);
+				// on the ground, irregular obstacles only block where their triangles actually are:
+				if (collision_x_or_y && !in_air && !touches_obstacle_shape(i, player_box)) collision_x_or_y = 0;
 				if (collision_x_or_y && obstacle_box != &p)
 				{	
 					collision = true;
@@ -947,13 +972,7 @@ void PlayMode::update(float elapsed) {
 							// - Player is sufficiently close to the edge of the platform vertically
 							// - Jump key has been released from the previous press
 							if (z_relative < obstacle_height) {
-								bool barrier = false;
-								for (Collision::AABB& b : barriers) {
-									if (b.c == p.c && b.r == p.r) {
-										barrier = true;
-										break;
-									}
-								}
+								bool barrier = obstacle_is_barrier[i];
 								if (!barrier) {
 									if (obstacle_height - z_relative < 0.5f || /* on-ground climb */
 										obstacle_height - z_relative < 2.0f) { /* in-air climb */
@@ -1043,21 +1062,10 @@ void PlayMode::update(float elapsed) {
 		// set shadow pos
 		shadow->position.x = player.transform->position.x;
 		shadow->position.y = player.transform->position.y;
-		Collision::AABB* tmp = nullptr;
-		for (Collision::AABB& p : obstacles) {
-			if (Collision::testCollisionXYStrict(p, player_box) && p.r.z + p.c.z <= player.transform->position.z) {
-				if (tmp == nullptr) {
-					tmp = &p;
-				}
-				else {
-					if (p.r.z + p.c.z >= tmp->c.z + tmp->r.z) {
-						tmp = &p;
-					}
-				}
-			}
-		}
-		if (tmp != nullptr) {
-			shadow->position.z = tmp->c.z + tmp->r.z + shadow_base_height;
+		// highest obstacle top under the player:
+		float top;
+		if (obstacle_columns.top_below(player_box, player.transform->position.z, &top)) {
+			shadow->position.z = top + shadow_base_height;
 		}
 		else {
 			shadow->position.z = shadow_base_height;
@@ -1145,12 +1153,16 @@ void PlayMode::update(float elapsed) {
 		}
 
 		// collectables checking
-		for (auto it = collectable_boxes.begin(); it != collectable_boxes.end(); it++)
+		candidates.clear();
+		collectable_tree.query(player_box, &candidates);
+		for (uint32_t i : candidates)
 		{
+			auto it = collectable_order[i];
 			std::string name = it->first;  // string (key)
 			Collision::AABB& box = it->second;
 			if (Collision::testCollision(box, player_box))
 			{
+				collectable_tree.remove(collectable_proxies[i]);
 				box.c.z = -100.0f;
 				Scene::Transform* transform = collectable_transforms.at(name);
 				transform->position.z = -100.0f;
@@ -1160,14 +1172,15 @@ void PlayMode::update(float elapsed) {
 		}
 
 		// reset locations (crosses)
-		for (auto it = reset_locations.begin(); it != reset_locations.end(); it++)
+		reset_grid.query(player_box, 0.2f, &candidates);
+		for (uint32_t i : candidates)
 		{
-			Collision::AABB& box = *it;
+			Collision::AABB& box = reset_locations[i];
 			if (testCollisionXY(box, player_box))
 			{
 				if (std::abs(box.c.z - (player_box.c.z - player_box.r.z)) < 0.5f)
 				{
-					switch_scene((Scene&)*chase1_scene, (MeshBuffer&)*chase1_meshes, walkmesh_chase1);
+					switch_scene((Scene&)*chase1_scene, (MeshBuffer&)*chase1_meshes, nullptr);
 					return;
 				}
 			}
@@ -1212,9 +1225,8 @@ void PlayMode::update(float elapsed) {
 			player_animations[2].update(elapsed);
 			anim_player = &player_animations[2];
 		}
-		player_drawable->pipeline.set_uniforms = [anim_player]() {
-			anim_player->set_uniform(bone_vertex_color_program->bones_mat4x3_array);
-		};
+		player_mixer.crossfade(anim_player, PlayerAnimationFade);
+		player_mixer.update(elapsed); //(evaluated in draw, by animation_system)
 
 		//reset button press counters:
 		left.downs = 0;
@@ -1236,7 +1248,7 @@ void PlayMode::update(float elapsed) {
 					switch_scene((Scene&)*level2_scene, (MeshBuffer&)*level2_meshes, walkmesh_level2);
 					ingredients_collected = 0;
 					cur_objective++;
-					background_loop->stop();
+					background_loop.stop();
 					background_loop = Sound::loop(*jazz_sample, 0.35f, 0.0f);
 					return;
 				}
@@ -1254,14 +1266,15 @@ void PlayMode::update(float elapsed) {
 			shark_box.c.z += shark_box.r.z; // coordinate frame at the bottom of the shark
 			if (glm::length(diff) < 0.3f)
 			{
-				switch_scene((Scene&)*chase1_scene, (MeshBuffer&)*chase1_meshes, walkmesh_chase1);
+				switch_scene((Scene&)*chase1_scene, (MeshBuffer&)*chase1_meshes, nullptr);
 				return;
 			}
 			//else
 			{
 				// try to go in direction of octopus
-				for (Collision::AABB& p : obstacles)
+				for (uint32_t i : obstacle_candidates(shark_box, 0.0f))
 				{
+					Collision::AABB& p = obstacles[i];
 					if (Collision::testCollision(p, shark_box))
 					{
 						// go up instead
@@ -1411,12 +1424,20 @@ void PlayMode::update(float elapsed) {
 		player_box.c.z += player_box.r.z - 0.001f; // hardcode z-offset because in blender frame is at bottom
 		bool reset_pos = false;
 
+		// long frames at high fall speeds can skip right over thin platforms, so sweep the fall first:
+		if (in_air && jump_up_velocity < 0.0f) {
+			sweep_fall(player.transform->position, &temp_pos, &player_box);
+		}
+
 		// collision checking
 		bool collision = false;
-		for (Collision::AABB& p : obstacles)
+		for (uint32_t i : obstacle_candidates(player_box, 0.2f))
 		{
+			Collision::AABB& p = obstacles[i];
 			bool landed_on_platform = false;
 			int collision_x_or_y = Collision::testCollision(p, player_box);
+			// on the ground, irregular obstacles only block where their triangles actually are:
+			if (collision_x_or_y && !in_air && !touches_obstacle_shape(i, player_box)) collision_x_or_y = 0;
 			if (collision_x_or_y && obstacle_box != &p)
 			{
 				collision = true;
@@ -1501,21 +1522,10 @@ void PlayMode::update(float elapsed) {
 		// set shadow pos
 		shadow->position.x = player.transform->position.x;
 		shadow->position.y = player.transform->position.y;
-		Collision::AABB* tmp = nullptr;
-		for (Collision::AABB& p : obstacles) {
-			if (Collision::testCollisionXYStrict(p, player_box) && p.r.z + p.c.z <= player.transform->position.z) {
-				if (tmp == nullptr) {
-					tmp = &p;
-				}
-				else {
-					if (p.r.z + p.c.z >= tmp->c.z + tmp->r.z) {
-						tmp = &p;
-					}
-				}
-			}
-		}
-		if (tmp != nullptr) {
-			shadow->position.z = tmp->c.z + tmp->r.z + shadow_base_height;
+		// highest obstacle top under the player:
+		float top;
+		if (obstacle_columns.top_below(player_box, player.transform->position.z, &top)) {
+			shadow->position.z = top + shadow_base_height;
 		}
 		else {
 			shadow->position.z = shadow_base_height;
@@ -1555,14 +1565,15 @@ void PlayMode::update(float elapsed) {
 		}
 
 		// reset locations (crosses)
-		for (auto it = reset_locations.begin(); it != reset_locations.end(); it++)
+		reset_grid.query(player_box, 0.2f, &candidates);
+		for (uint32_t i : candidates)
 		{
-			Collision::AABB& box = *it;
+			Collision::AABB& box = reset_locations[i];
 			if (testCollisionXY(box, player_box))
 			{
 				if (std::abs(box.c.z + box.r.z - (player_box.c.z - player_box.r.z)) < 0.5f)
 				{
-					switch_scene((Scene&)*chasef_scene, (MeshBuffer&)*chasef_meshes, walkmesh_chasef);
+					switch_scene((Scene&)*chasef_scene, (MeshBuffer&)*chasef_meshes, nullptr);
 					return;
 				}
 			}
@@ -1572,7 +1583,7 @@ void PlayMode::update(float elapsed) {
 		// If into the ocean, play ending script
 		if (player.transform->position.y > 170.0f && player.transform->position.z < 10.0f) {
 			game_state = END;
-			background_loop->stop();
+			background_loop.stop();
 			background_loop = Sound::loop(*jazz_sample, 0.35f, 0.0f);
 			black_screen = true;
 			game_over = true;
@@ -1599,14 +1610,15 @@ void PlayMode::update(float elapsed) {
 			shark_box.c.z += shark_box.r.z; // coordinate frame at the bottom of the shark
 			if (glm::length(diff) < 1.0f)
 			{
-				switch_scene((Scene&)*chasef_scene, (MeshBuffer&)*chasef_meshes, walkmesh_chasef);
+				switch_scene((Scene&)*chasef_scene, (MeshBuffer&)*chasef_meshes, nullptr);
 				return;
 			}
 			//else
 			{
 				// try to go in direction of octopus
-				for (Collision::AABB& p : obstacles)
+				for (uint32_t i : obstacle_candidates(shark_box, 0.0f))
 				{
+					Collision::AABB& p = obstacles[i];
 					if (Collision::testCollision(p, shark_box))
 					{
 						// go up instead
@@ -1664,6 +1676,19 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 		glUseProgram(0);
 	}
 
+	//gather this frame's bone matrices (all skinned drawables read from the one palette):
+	bone_palette.clear();
+	if (player_drawable) {
+		//(skinned drawables are culled and throttled by how they look from the camera)
+		glm::mat4 world_to_clip = player.camera->make_projection() * glm::mat4(player.camera->transform->make_world_to_local());
+		glm::mat4x3 player_to_world = player_drawable->transform->make_local_to_world();
+		glm::vec3 center = player_to_world * glm::vec4(0.0f, 0.0f, PlayerBoundingRadius, 1.0f);
+		uint32_t player_job = animation_system.add(&player_mixer, AnimationSystem::detail(world_to_clip, center, PlayerBoundingRadius));
+		animation_system.evaluate(&bone_palette);
+		player_bones_offset = animation_system.offsets[player_job];
+	}
+	bone_palette.upload();
+
 	scene.draw(*player.camera);
 
 	{ //use DrawLines to overlay some text:
@@ -1835,15 +1860,20 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	GL_ERRORS();
 }
 
+WalkMesh const &PlayMode::walk_surface() const {
+	if (tiled_walkmesh) return tiled_walkmesh->tile_mesh(player.at.tile);
+	return *walkmesh;
+}
+
 void PlayMode::step_in_3D(glm::vec3 & pos, glm::quat & rot)
 {
-	pos = walkmesh->to_world_point(player.at);
+	pos = walk_surface().to_world_point(player.at);
 
 	{ //update player's rotation to respect local (smooth) up-vector:
 
 		glm::quat adjust = glm::rotation(
 			player.transform->rotation * glm::vec3(0.0f, 0.0f, 1.0f), //current up vector
-			walkmesh->to_world_smooth_normal(player.at) //smoothed up vector at walk location
+			walk_surface().to_world_smooth_normal(player.at) //smoothed up vector at walk location
 		);
 		rot = glm::normalize(adjust * player.transform->rotation);
 	}
@@ -1856,7 +1886,8 @@ void PlayMode::step_in_mesh(glm::vec3& remain)
 		if (remain == glm::vec3(0.0f)) break;
 		WalkPoint end;
 		float time;
-		walkmesh->walk_in_triangle(player.at, remain, &end, &time);
+		if (tiled_walkmesh) tiled_walkmesh->walk_in_triangle(player.at, remain, &end, &time);
+		else walkmesh->walk_in_triangle(player.at, remain, &end, &time);
 		player.at = end;
 		if (time == 1.0f) {
 			//finished within triangle:
@@ -1867,7 +1898,7 @@ void PlayMode::step_in_mesh(glm::vec3& remain)
 		remain *= (1.0f - time);
 		//try to step over edge:
 		glm::quat rotation;
-		if (walkmesh->cross_edge(player.at, &end, &rotation)) {
+		if (tiled_walkmesh ? tiled_walkmesh->cross_edge(player.at, &end, &rotation) : walkmesh->cross_edge(player.at, &end, &rotation)) {
 			//stepped to a new triangle:
 			player.at = end;
 			//rotate step to follow surface:
@@ -1875,9 +1906,10 @@ void PlayMode::step_in_mesh(glm::vec3& remain)
 		}
 		else {
 			//ran into a wall, bounce / slide along it:
-			glm::vec3 const& a = walkmesh->vertices[player.at.indices.x];
-			glm::vec3 const& b = walkmesh->vertices[player.at.indices.y];
-			glm::vec3 const& c = walkmesh->vertices[player.at.indices.z];
+			WalkMesh const &surface = walk_surface();
+			glm::vec3 const& a = surface.vertices[player.at.indices.x];
+			glm::vec3 const& b = surface.vertices[player.at.indices.y];
+			glm::vec3 const& c = surface.vertices[player.at.indices.z];
 			glm::vec3 along = glm::normalize(b - a);
 			glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
 			glm::vec3 in = glm::cross(normal, along);
@@ -2016,15 +2048,25 @@ void PlayMode::push_level2_messages() {
 }
 
 void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh const * cur_walkmesh) {
+	// the chase levels (picked out by their scenes) are walked in tiles:
+	walkmesh = cur_walkmesh;
+	tiled_walkmesh = (&cur_scene == &*chase1_scene ? tiled_walkmesh_chase1 : &cur_scene == &*chasef_scene ? tiled_walkmesh_chasef : nullptr);
+	if (!walkmesh && !tiled_walkmesh) throw std::runtime_error("No walkmesh for scene.");
+
 	// reset operations
 	obstacle_box = nullptr;
 	platform_box = nullptr;
 	player.transform = nullptr;
 	player.camera = nullptr;
 	shadow = nullptr;
+	shark = nullptr;
 	obstacles.clear();
+	obstacle_is_barrier.clear();
+	obstacle_shapes.clear();
+	barriers.clear();
 	collectable_transforms.clear();
 	collectable_boxes.clear();
+	player_mixer.clear();
 	player_animations.clear();
 	reset_locations.clear();
 	messages.clear();
@@ -2064,14 +2106,14 @@ void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh con
 	}
 	if (player.transform == nullptr) throw std::runtime_error("GameObject player not found.");
 	if (shadow == nullptr) throw std::runtime_error("GameObject shadow not found.");
-	if (shark == nullptr && cur_walkmesh != walkmesh_chasef) throw std::runtime_error("GameObject shark not found.");
+	if (shark == nullptr && tiled_walkmesh != tiled_walkmesh_chasef) throw std::runtime_error("GameObject shark not found.");
 	
 	if (cur_walkmesh == walkmesh_tutorial_level1) {
 		push_tutorial_level1_messages();
 	} else if (cur_walkmesh == walkmesh_level2) {
 		push_level2_messages();
 	}
-	else if (cur_walkmesh == walkmesh_chasef) {
+	else if (tiled_walkmesh == tiled_walkmesh_chasef) {
 		push_chasef_messages();
 	}
 
@@ -2091,6 +2133,15 @@ void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh con
 			glm::vec3 center = 0.5f * (min + max);
 			glm::vec3 rad = 0.5f * (max - min);
 			obstacles.emplace_back(Collision::AABB(center, rad));
+			obstacle_is_barrier.emplace_back(false);
+			auto f = cur_mesh.positions.find(mesh.first);
+			if (f != cur_mesh.positions.end()) {
+				auto &shape = obstacle_shape_cache[&f->second];
+				if (!shape) shape = std::make_shared< Collision::TriangleBVH >(f->second);
+				obstacle_shapes.emplace_back(shape);
+			} else {
+				obstacle_shapes.emplace_back(nullptr);
+			}
 		}
 		else if (mesh.first.find(str_barrier) != std::string::npos)
 		{
@@ -2100,6 +2151,8 @@ void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh con
 			glm::vec3 rad = 0.5f * (max - min);
 			Collision::AABB box = Collision::AABB(center, rad);
 			obstacles.emplace_back(box);
+			obstacle_is_barrier.emplace_back(true);
+			obstacle_shapes.emplace_back(nullptr);
 			barriers.emplace_back(box);
 		}
 		else if (mesh.first.find(str_collectable) != std::string::npos)
@@ -2130,6 +2183,18 @@ void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh con
 		}
 	}
 
+	// build broadphase grids over the (static in x and y) boxes found above
+	obstacle_grid.build(obstacles);
+	obstacle_columns.build(obstacles);
+	reset_grid.build(reset_locations);
+	collectable_tree.clear();
+	collectable_order.clear();
+	collectable_proxies.clear();
+	for (auto it = collectable_boxes.begin(); it != collectable_boxes.end(); it++) {
+		collectable_proxies.emplace_back(collectable_tree.insert(it->second, uint32_t(collectable_order.size())));
+		collectable_order.emplace_back(it);
+	}
+
 	//create a player camera attached to a child of the player transform:
 	scene.transforms.emplace_back();
 	scene.cameras.emplace_back(&scene.transforms.back());
@@ -2138,8 +2203,13 @@ void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh con
 	player.camera->near = 0.01f;
 
 	//start player walking at nearest walk point:
-	player.at = cur_walkmesh->nearest_walk_point(player.transform->position);
-	walkmesh = cur_walkmesh;
+	if (tiled_walkmesh) {
+		//(wait for the tiles around the start; after this they stream in as the player moves)
+		tiled_walkmesh->update_resident(player.transform->position, WalkTileRadius, true);
+		player.at = tiled_walkmesh->nearest_walk_point(player.transform->position);
+	} else {
+		player.at = walkmesh->nearest_walk_point(player.transform->position);
+	}
 
 	update_camera();
 
@@ -2167,9 +2237,11 @@ void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh con
 				drawable.pipeline.OBJECT_TO_LIGHT_mat4x3 = bone_vertex_color_program->object_to_light_mat4x3;
 				drawable.pipeline.NORMAL_TO_LIGHT_mat3 = bone_vertex_color_program->normal_to_light_mat3;
 
-				BoneAnimationPlayer* anim_player = &player_animations.back();
-				drawable.pipeline.set_uniforms = [anim_player]() {
-					anim_player->set_uniform(bone_vertex_color_program->bones_mat4x3_array);
+				player_mixer.crossfade(&player_animations.back(), 0.0f);
+				drawable.pipeline.textures[0].texture = bone_palette.texture;
+				drawable.pipeline.textures[0].target = GL_TEXTURE_BUFFER;
+				drawable.pipeline.set_uniforms = [this]() {
+					glUniform1i(bone_vertex_color_program->bones_offset_int, player_bones_offset);
 				};
 
 
@@ -2179,6 +2251,65 @@ void PlayMode::switch_scene(Scene& cur_scene, MeshBuffer& cur_mesh, WalkMesh con
 
 }
 
+std::vector<uint32_t> const &PlayMode::obstacle_candidates(Collision::AABB const &box, float margin) {
+	obstacle_grid.query(box, margin, &candidates);
+	// the platform we're standing on always needs checking (that's how we notice walking off of it)
+	if (obstacle_box != nullptr) {
+		uint32_t index = uint32_t(obstacle_box - obstacles.data());
+		auto f = std::lower_bound(candidates.begin(), candidates.end(), index);
+		if (f == candidates.end() || *f != index) candidates.insert(f, index);
+	}
+	return candidates;
+}
+
+void PlayMode::sweep_fall(glm::vec3 const &from, glm::vec3 *temp_pos_, Collision::AABB *player_box_) {
+	assert(temp_pos_);
+	auto &temp_pos = *temp_pos_;
+	assert(player_box_);
+	auto &player_box = *player_box_;
+
+	// sweep the box from last frame's position to this one:
+	glm::vec3 move = temp_pos - from;
+	Collision::AABB start_box = player_box;
+	start_box.c -= move;
+	Collision::AABB swept_box = Collision::AABB(start_box.c + 0.5f * move, start_box.r + 0.5f * glm::abs(move));
+
+	// (only landings count: side contacts along the way are left to the per-box checks, and must not hide a
+	//  platform top behind them; the platform the player already stands on isn't a landing either)
+	obstacle_grid.query(swept_box, 0.0f, &sweep_candidates);
+	if (obstacle_box) {
+		uint32_t standing = uint32_t(obstacle_box - obstacles.data());
+		sweep_candidates.erase(std::remove(sweep_candidates.begin(), sweep_candidates.end(), standing), sweep_candidates.end());
+	}
+	float t;
+	glm::vec3 normal;
+	uint32_t index;
+	if (!Collision::sweepAABB(start_box, move, obstacles, sweep_candidates, &t, &normal, &index, glm::vec3(0.0f, 0.0f, 1.0f))) return;
+	Collision::AABB &p = obstacles[index];
+
+	// only snap up if the player still ends the frame over the obstacle:
+	float delta = (p.c.z + p.r.z) - (player_box.c.z - player_box.r.z) - 0.001f;
+	if (delta <= 0.0f) return;
+	Collision::AABB landed_box = player_box;
+	landed_box.c.z += delta;
+	if (!Collision::testCollision(p, landed_box)) return;
+
+	z_relative += delta;
+	temp_pos.z += delta;
+	player_box = landed_box;
+}
+
+bool PlayMode::touches_obstacle_shape(uint32_t index, Collision::AABB const &box) const {
+	Collision::TriangleBVH const *shape = obstacle_shapes[index].get();
+	if (!shape) return true; //no triangles kept; the box is all there is
+	// fit a vertical capsule inside the box:
+	float radius = std::min(box.r.x, box.r.y);
+	float half = std::max(0.0f, box.r.z - radius);
+	if (shape->testCapsule(box.c - glm::vec3(0.0f, 0.0f, half), box.c + glm::vec3(0.0f, 0.0f, half), radius)) return true;
+	// a capsule that ended up wholly inside a closed mesh (e.g. after a long frame) touches no triangles, but still collides:
+	return shape->closed && shape->contains(box.c);
+}
+
 bool PlayMode::shark_indices() {
 	return (revelation_message >= 3 && revelation_message <= 14) || revelation_message == 19;
 }
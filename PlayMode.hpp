@@ -2,8 +2,11 @@
 
 #include "Scene.hpp"
 #include "WalkMesh.hpp"
+#include "TiledWalkMesh.hpp"
 #include "Collision.hpp"
+#include "TriangleBVH.hpp"
 #include "BoneAnimation.hpp"
+#include "AnimationSystem.hpp"
 #include "Sound.hpp"
 
 #include <glm/glm.hpp>
@@ -11,6 +14,7 @@
 #include <vector>
 #include <deque>
 #include <map>
+#include <memory>
 
 struct PlayMode : Mode {
 	PlayMode();
@@ -34,6 +38,7 @@ struct PlayMode : Mode {
 	bool hexapus_indices();
 
 	// scene switching function that changes from one level to another
+	// (walkmesh is nullptr for the chase levels, which are walked in tiles; see tiled_walkmesh)
 	void switch_scene(Scene& scene, MeshBuffer& mesh, WalkMesh const * walkmesh);
 
 	void reset_sliding();
@@ -101,8 +106,14 @@ struct PlayMode : Mode {
 	// The following two variables are updated in switch_scene when the necessasity comes up
 	// local copy of the game scene (so code can change it during gameplay)
 	Scene scene;
-	// current walkmesh based on game progress
+	// current walkmesh based on game progress (nullptr on tiled levels)
 	WalkMesh const * walkmesh = nullptr;
+	// tiled (streamed) walkmesh of the current level, if it has one; the player walks on this instead:
+	TiledWalkMesh * tiled_walkmesh = nullptr;
+	// tiles within this distance (in xy) of the player are kept loaded:
+	static constexpr float WalkTileRadius = 40.0f;
+	// mesh that player.at's indices refer to (the current tile, when walking on tiles):
+	WalkMesh const &walk_surface() const;
 	// when cutscenes are loaded
 	bool cinematic = false;
 	bool black_screen = false;
@@ -142,6 +153,28 @@ struct PlayMode : Mode {
 	std::map<std::string, Scene::Transform*> collectable_transforms;
 	std::map<std::string, Collision::AABB> collectable_boxes;
 
+	// broadphase over the boxes above (built in switch_scene)
+	Collision::UniformGrid obstacle_grid;
+	Collision::HeightColumns obstacle_columns; // for "highest obstacle top under the player" (shadow placement)
+	Collision::UniformGrid reset_grid;
+	std::vector<bool> obstacle_is_barrier; // parallel to obstacles
+	// triangle-accurate shapes of "o_" obstacles (parallel to obstacles; nullptr where there are only boxes):
+	std::vector<std::shared_ptr<Collision::TriangleBVH const>> obstacle_shapes;
+	std::map<std::vector<glm::vec3> const *, std::shared_ptr<Collision::TriangleBVH const>> obstacle_shape_cache; // built once per mesh
+	// does 'box' (as a capsule) touch obstacle index's triangles? (always true for obstacles without a shape)
+	bool touches_obstacle_shape(uint32_t index, Collision::AABB const &box) const;
+	// collectables come and go, so they live in a dynamic tree (collected ones are removed):
+	Collision::AABBTree collectable_tree;
+	std::vector<std::map<std::string, Collision::AABB>::iterator> collectable_order; // collectable_tree data -> entry
+	std::vector<uint32_t> collectable_proxies; // collectable_tree data -> proxy
+	std::vector<uint32_t> candidates; // scratch space for grid queries
+	std::vector<uint32_t> sweep_candidates; // scratch space for sweep_fall's grid query
+	// obstacles that might touch 'box' (plus the current platform), in obstacles order:
+	std::vector<uint32_t> const &obstacle_candidates(Collision::AABB const &box, float margin);
+	// continuous landing check for a fall from 'from' to *temp_pos: if the player box passed through the top of an obstacle,
+	// raise *temp_pos / *player_box / z_relative onto it (the discrete tests below then land the player as usual)
+	void sweep_fall(glm::vec3 const &from, glm::vec3 *temp_pos, Collision::AABB *player_box);
+
 	// coordinates of messages. 
 	std::vector<std::pair< glm::vec3, std::string>> messages;
 	std::vector<std::pair< glm::vec3, std::string>> objectives;
@@ -149,6 +182,12 @@ struct PlayMode : Mode {
 
 	//animation controls
 	std::vector< BoneAnimationPlayer > player_animations;
+	BoneAnimationMixer player_mixer; //crossfades between player_animations; drawn by player_drawable
+	static constexpr float PlayerAnimationFade = 0.15f; //seconds to crossfade between jump / walk / climb
+	AnimationSystem animation_system; //evaluates skeletons (in parallel) at draw time
+	BonePalette bone_palette; //bone matrices of all skinned drawables, rebuilt each draw
+	uint32_t player_bones_offset = 0; //where player_mixer's matrices are in bone_palette
+	static constexpr float PlayerBoundingRadius = 1.0f; //sphere (resting on the player's feet) used for animation culling / level of detail
 	Scene::Drawable* player_drawable = nullptr;
 	bool landed = false;
 	enum Player_State {PAUSED, STILL, WALK, JUMP, SLIDE, CLIMB};
@@ -185,10 +224,10 @@ struct PlayMode : Mode {
 	int view_scene = 0;
 
 	// Sounds
-	std::shared_ptr< Sound::PlayingSample > jump_sound;
-	std::shared_ptr< Sound::PlayingSample > land_sound;
-	std::shared_ptr< Sound::PlayingSample > collect_sound;
-	std::shared_ptr< Sound::PlayingSample > background_loop;
+	Sound::PlayingHandle jump_sound;
+	Sound::PlayingHandle land_sound;
+	Sound::PlayingHandle collect_sound;
+	Sound::PlayingHandle background_loop;
 
 	// shark variables
 	Scene::Transform* shark = nullptr;
@@ -4,24 +4,270 @@
 
 #include <SDL.h>
 
-#include <list>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include <cassert>
 #include <exception>
 #include <iostream>
 #include <algorithm>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOUND_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+//decoded audio for one playback of a StreamingSample:
+// the decoder thread writes into 'ring', the audio callback reads from it; neither waits on the other.
+struct Sound::Stream {
+	Stream(std::string const &filename_, bool loop_) : filename(filename_), loop(loop_), ring(Size, 0.0f) {
+		if (is_opus(filename)) opus.reset(new OpusStreamReader(filename));
+		else wav.reset(new WavStreamReader(filename));
+	}
+
+	//decoder side: decode until the ring is (almost) full or at least 'limit' samples are ready:
+	void fill(uint32_t limit = Size);
+
+	static bool is_opus(std::string const &filename) {
+		return filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus";
+	}
+
+	std::string filename;
+	//exactly one of these is set (only used by whoever is filling):
+	std::unique_ptr< OpusStreamReader > opus;
+	std::unique_ptr< WavStreamReader > wav;
+	bool loop; //rewind at the end of the file?
+
+	static constexpr uint32_t Size = 1 << 16; //ring size in samples (~1.4 seconds); must be a power of two
+	std::vector< float > ring;
+	std::atomic< uint32_t > head{0}; //samples written so far (written only by decoder)
+	std::atomic< uint32_t > tail{0}; //samples read so far (written only by audio callback)
+	std::atomic< bool > finished{false}; //decoder is done (end of non-looping file, or error); nothing more will arrive
+};
+
+void Sound::Stream::fill(uint32_t limit) {
+	constexpr uint32_t MinRead = 1024; //don't bother decoding into less space than this
+	bool rewound = false;
+	try {
+		while (!finished.load(std::memory_order_relaxed)) {
+			uint32_t h = head.load(std::memory_order_relaxed);
+			uint32_t ready = h - tail.load(std::memory_order_acquire);
+			if (ready >= limit || Size - ready < MinRead) break;
+			uint32_t at = h & (Size - 1);
+			uint32_t count = std::min(Size - ready, Size - at); //(contiguous space)
+			uint32_t got = (opus ? opus->read(ring.data() + at, count) : wav->read(ring.data() + at, count));
+			if (got == 0) {
+				if (loop && !rewound) { //(an empty file would rewind forever)
+					if (opus) opus->rewind();
+					else wav->rewind();
+					rewound = true;
+				} else {
+					finished.store(true, std::memory_order_release);
+				}
+				continue;
+			}
+			rewound = false;
+			head.store(h + got, std::memory_order_release);
+		}
+	} catch (std::exception &e) {
+		std::cerr << "Stopping stream of '" << filename << "':\n" << e.what() << std::endl;
+		finished.store(true, std::memory_order_release);
+	}
+}
 
 //local (to this file) data used by the audio system:
 namespace {
 
-	//handy constants:
-	constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate
-	constexpr uint32_t const MIX_SAMPLES = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+	using Sound::AUDIO_RATE;
+	using Sound::MIX_SAMPLES;
 
 	//The audio device:
 	SDL_AudioDeviceID device = 0;
 
-	//list of all currently playing samples:
-	std::list< std::shared_ptr< Sound::PlayingSample > > playing_samples;
+	//pool of playing-sample slots (see PlayingSample in Sound.hpp for which thread owns a slot when):
+	std::array< Sound::PlayingSample, Sound::MAX_PLAYING > pool;
+
+	//slots of all currently playing samples, oldest first (only touched by the audio callback):
+	std::array< uint32_t, Sound::MAX_PLAYING > playing;
+	uint32_t playing_count = 0;
+
+	//changes requested by the game thread, applied by the audio callback at the start of each block:
+	struct Command {
+		enum Type : uint8_t {
+			Play, //start the sample in slot 'index'
+			SetVolume, //slot's volume to value.x over 'ramp'
+			SetPan, //slot's pan to value.x over 'ramp'
+			SetPosition, //slot's position to value over 'ramp'
+			SetHalfVolumeRadius, //slot's half_volume_radius to value.x over 'ramp'
+			Stop, //fade out slot's sample over 'ramp'
+			StopAll, //fade out everything
+			SetListener, //listener position to value, right to right, over 'ramp'
+			SetGlobalVolume, //global volume to value.x over 'ramp'
+		} type = Play;
+		uint32_t index = -1U; //slot of the playing sample (if any)
+		uint32_t generation = 0; //...and its generation (commands for an older sample in the same slot are dropped)
+		glm::vec3 value = glm::vec3(0.0f);
+		glm::vec3 right = glm::vec3(0.0f);
+		float ramp = 0.0f;
+	};
+
+	//single-producer (game thread) / single-consumer (audio callback) ring buffer;
+	// push and pop never wait on the other side:
+	template< typename T, uint32_t Size >
+	struct Ring {
+		static_assert((Size & (Size - 1)) == 0, "Ring size must be a power of two.");
+
+		//producer: false if full:
+		bool push(T &&t) {
+			uint32_t h = head.load(std::memory_order_relaxed);
+			if (h - tail.load(std::memory_order_acquire) == Size) return false;
+			slots[h & (Size - 1)] = std::move(t);
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+		//consumer: false if empty:
+		bool pop(T *t) {
+			uint32_t t_ = tail.load(std::memory_order_relaxed);
+			if (t_ == head.load(std::memory_order_acquire)) return false;
+			*t = std::move(slots[t_ & (Size - 1)]);
+			tail.store(t_ + 1, std::memory_order_release);
+			return true;
+		}
+
+		std::array< T, Size > slots;
+		alignas(64) std::atomic< uint32_t > head{0}; //next slot to write (written only by producer)
+		alignas(64) std::atomic< uint32_t > tail{0}; //next slot to read (written only by consumer)
+	};
+	Ring< Command, 1024 > commands;
+
+	//slots whose samples have stopped, handed back by the audio callback to the game thread:
+	// (never full: there are only MAX_PLAYING slots)
+	Ring< uint32_t, Sound::MAX_PLAYING > retired;
+
+	//slots the game thread can hand out (only touched by the game thread):
+	struct FreeSlots {
+		FreeSlots() {
+			for (uint32_t s = 0; s < Sound::MAX_PLAYING; ++s) {
+				slots[s] = Sound::MAX_PLAYING - 1 - s; //(so slot 0 is handed out first)
+			}
+		}
+		std::array< uint32_t, Sound::MAX_PLAYING > slots;
+		uint32_t count = Sound::MAX_PLAYING;
+	} free_slots;
+
+	//game thread: take back slots the audio callback is done with, letting go of their streams:
+	void reclaim() {
+		uint32_t index;
+		while (retired.pop(&index)) {
+			//(the decoder thread may still hold the stream; whoever lets go last frees it -- never the audio callback)
+			pool[index].stream.reset();
+			free_slots.slots[free_slots.count++] = index;
+		}
+	}
+
+	//game thread: reclaim stopped slots, then reset and hand out a free one:
+	// (returns nullptr if all slots are playing)
+	Sound::PlayingSample *claim(Sound::PlayingHandle *handle_) {
+		assert(handle_);
+		auto &handle = *handle_;
+		reclaim();
+		if (free_slots.count == 0) return nullptr;
+		uint32_t index;
+		index = free_slots.slots[--free_slots.count];
+
+		Sound::PlayingSample &slot = pool[index];
+		//(re-stamp before clearing 'stopped', so old handles never mistake the new sample for theirs)
+		handle.index = index;
+		handle.generation = slot.generation.fetch_add(1) + 1;
+		slot.stopped = false;
+
+		//(the caller fills in the sample, stream, and controls)
+		slot.i = 0;
+		slot.adpcm = Sound::PlayingSample::ADPCMState();
+		slot.stopping = false;
+		slot.voice = Sound::PlayingSample::New;
+		return &slot;
+	}
+
+	//background thread that keeps every playing Stream's ring topped up:
+	struct StreamDecoder {
+		~StreamDecoder() {
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				quit = true;
+			}
+			wake.notify_all();
+			if (thread.joinable()) thread.join();
+		}
+
+		//game thread: start keeping 'stream' filled:
+		void add(std::shared_ptr< Sound::Stream > const &stream) {
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				if (!thread.joinable()) thread = std::thread([this]() { run(); });
+				streams.emplace_back(stream);
+			}
+			wake.notify_one();
+		}
+
+		void run() {
+			std::vector< std::shared_ptr< Sound::Stream > > to_fill;
+			std::unique_lock< std::mutex > lock(mutex);
+			while (!quit) {
+				//drop streams that are done, or that nothing plays any more:
+				streams.erase(std::remove_if(streams.begin(), streams.end(), [](std::shared_ptr< Sound::Stream > const &stream) {
+					return stream.use_count() == 1 || stream->finished.load(std::memory_order_relaxed);
+				}), streams.end());
+				to_fill = streams;
+
+				lock.unlock();
+				for (auto const &stream : to_fill) {
+					stream->fill();
+				}
+				to_fill.clear();
+				lock.lock();
+
+				//(the audio callback never signals; a ring lasts much longer than this nap)
+				wake.wait_for(lock, std::chrono::milliseconds(10));
+			}
+		}
+
+		std::mutex mutex; //guards streams and quit (only contended by the game thread starting a stream)
+		std::condition_variable wake;
+		std::vector< std::shared_ptr< Sound::Stream > > streams;
+		bool quit = false;
+		std::thread thread;
+	};
+	StreamDecoder stream_decoder;
+
+	//commands that didn't fit in the ring (only touched by the game thread; retried on the next post):
+	std::vector< Command > overflow;
+
+	//game thread: queue a command for the audio callback:
+	void post(Command &&command) {
+		//keep commands in order: anything already waiting goes first:
+		uint32_t sent = 0;
+		while (sent < overflow.size() && commands.push(std::move(overflow[sent]))) ++sent;
+		overflow.erase(overflow.begin(), overflow.begin() + sent);
+
+		if (!overflow.empty() || !commands.push(std::move(command))) {
+			overflow.emplace_back(std::move(command));
+		}
+	}
+
+	void post_sample(Command::Type type, Sound::PlayingHandle const &handle, glm::vec3 const &value, float ramp) {
+		Command command;
+		command.type = type;
+		command.index = handle.index;
+		command.generation = handle.generation;
+		command.value = value;
+		command.ramp = ramp;
+		post(std::move(command));
+	}
 
 }
 
@@ -33,22 +279,125 @@ Sound::Ramp< float > Sound::volume = Sound::Ramp< float >(1.0f);
 //global listener information:
 Sound::Listener Sound::listener;
 
+//voice counts of the last mixed block:
+std::atomic< uint32_t > Sound::max_voices(Sound::MAX_VOICES);
+std::atomic< uint32_t > Sound::real_voice_count(0);
+std::atomic< uint32_t > Sound::virtual_voice_count(0);
+
 //This audio-mixing callback is defined below:
 void mix_audio(void *, Uint8 *buffer_, int len);
 
 //------------------------ public-facing --------------------------------
 
-Sound::Sample::Sample(std::string const &filename) {
+//IMA-ADPCM tables:
+static constexpr int32_t ADPCMSteps[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+static constexpr int32_t ADPCMIndexAdjust[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+//helper: advance ADPCM predictor/index by one nibble (shared by encoder and decoder, so they agree exactly):
+static inline void adpcm_step(uint32_t nibble, int32_t *predictor_, int32_t *index_) {
+	auto &predictor = *predictor_;
+	auto &index = *index_;
+	int32_t step = ADPCMSteps[index];
+	int32_t delta = step >> 3;
+	if (nibble & 4) delta += step;
+	if (nibble & 2) delta += step >> 1;
+	if (nibble & 1) delta += step >> 2;
+	predictor += (nibble & 8) ? -delta : delta;
+	predictor = std::max(-32768, std::min(32767, predictor));
+	index = std::max(0, std::min(88, index + ADPCMIndexAdjust[nibble & 7]));
+}
+
+//helper: float to 16-bit:
+static inline int16_t to_int16(float f) {
+	return int16_t(std::lround(std::max(-32768.0f, std::min(32767.0f, f * 32768.0f))));
+}
+
+Sound::Sample::Sample(std::string const &filename, Format format_) {
+	uint32_t source_bits = 32;
 	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
-		load_wav(filename, &data);
+		load_wav(filename, &data, &source_bits);
 	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
-		load_opus(filename, &data);
+		load_opus(filename, &data, &source_bits);
 	} else {
 		throw std::runtime_error("Sample '" + filename + "' doesn't end in either \".png\" or \".opus\" -- unsure how to load.");
 	}
+	if (format_ == Auto) format_ = (source_bits <= 16 ? Int16 : Float);
+	if (format_ != Float) {
+		std::vector< float > loaded;
+		loaded.swap(data);
+		store(loaded, format_);
+	} else {
+		format = Float;
+		length = uint32_t(data.size());
+	}
+}
+
+Sound::Sample::Sample(std::vector< float > const &data_, Format format_) {
+	store(data_, format_);
+}
+
+void Sound::Sample::store(std::vector< float > const &data_, Format format_) {
+	format = (format_ == Auto ? Float : format_);
+	length = uint32_t(data_.size());
+	data.clear();
+	data16.clear();
+	adpcm.clear();
+	if (format == Float) {
+		data = data_;
+	} else if (format == Int16) {
+		data16.reserve(data_.size());
+		for (float f : data_) {
+			data16.emplace_back(to_int16(f));
+		}
+	} else if (format == ADPCM) {
+		uint32_t blocks = (length + ADPCMBlockSamples - 1) / ADPCMBlockSamples;
+		adpcm.assign(blocks * ADPCMBlockBytes, 0);
+		int32_t predictor = 0;
+		int32_t index = 0;
+		for (uint32_t i = 0; i < length; ++i) {
+			uint8_t *block = adpcm.data() + (i / ADPCMBlockSamples) * ADPCMBlockBytes;
+			uint32_t in_block = i % ADPCMBlockSamples;
+			if (in_block == 0) {
+				//block header: decoder state at the start of the block:
+				block[0] = uint8_t(uint16_t(int16_t(predictor)) & 0xff);
+				block[1] = uint8_t(uint16_t(int16_t(predictor)) >> 8);
+				block[2] = uint8_t(index);
+			}
+			//pick the nibble that gets closest to the sample:
+			int32_t diff = int32_t(to_int16(data_[i])) - predictor;
+			uint32_t nibble = 0;
+			if (diff < 0) {
+				nibble = 8;
+				diff = -diff;
+			}
+			int32_t step = ADPCMSteps[index];
+			if (diff >= step) { nibble |= 4; diff -= step; }
+			step >>= 1;
+			if (diff >= step) { nibble |= 2; diff -= step; }
+			step >>= 1;
+			if (diff >= step) { nibble |= 1; }
+			adpcm_step(nibble, &predictor, &index);
+			block[4 + in_block / 2] |= uint8_t(nibble << ((in_block & 1) * 4));
+		}
+	} else {
+		assert(0 && "Unknown sample format.");
+	}
 }
 
-Sound::Sample::Sample(std::vector< float > const &data_) : data(data_) {
+Sound::StreamingSample::StreamingSample(std::string const &filename_) : filename(filename_) {
+	if (Stream::is_opus(filename)) {
+		OpusStreamReader check(filename); //throws if the file won't open
+	} else if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
+		WavStreamReader check(filename); //throws if the file won't open (or has an unsupported format)
+	} else {
+		throw std::runtime_error("StreamingSample '" + filename + "' doesn't end in \".opus\" or \".wav\" -- unsure how to stream.");
+	}
 }
 
 
@@ -91,6 +440,11 @@ void Sound::shutdown() {
 }
 
 
+void Sound::update() {
+	reclaim();
+}
+
+
 void Sound::lock() {
 	if (device) SDL_LockAudioDevice(device);
 }
@@ -99,110 +453,122 @@ void Sound::unlock() {
 	if (device) SDL_UnlockAudioDevice(device);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, pan, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//helper: set up a playing sample in a free slot and queue it for the audio callback (empty handle if no slot is free, or the sample is empty):
+// (2D samples have a NaN position and radius, 3D samples a NaN pan)
+static Sound::PlayingHandle start(Sound::Sample const *sample, std::shared_ptr< Sound::Stream > const &stream, float priority,
+	float volume, float pan, glm::vec3 const &position, float half_volume_radius, bool loop) {
+	Sound::PlayingHandle handle;
+	if (sample && sample->length == 0) return handle; //nothing to play (and looping it would spin the mixer forever)
+	Sound::PlayingSample *slot = claim(&handle);
+	if (!slot) return handle;
+
+	slot->sample = sample;
+	slot->stream = stream;
+	slot->loop = loop;
+	slot->priority = priority;
+	slot->volume = Sound::Ramp< float >(volume);
+	slot->pan = Sound::Ramp< float >(pan);
+	slot->position = Sound::Ramp< glm::vec3 >(position);
+	slot->half_volume_radius = Sound::Ramp< float >(half_volume_radius);
+	if (stream) stream_decoder.add(stream);
+
+	post_sample(Command::Play, handle, glm::vec3(0.0f), 0.0f);
+	return handle;
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, position, half_volume_radius, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+static constexpr float NaN = std::numeric_limits< float >::quiet_NaN();
+
+Sound::PlayingHandle Sound::play(Sample const &sample, float volume, float pan) {
+	return start(&sample, nullptr, sample.priority, volume, pan, glm::vec3(NaN), NaN, false);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, pan, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingHandle Sound::play_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius) {
+	return start(&sample, nullptr, sample.priority, volume, NaN, position, half_volume_radius, false);
+}
+
+Sound::PlayingHandle Sound::loop(Sample const &sample, float volume, float pan) {
+	return start(&sample, nullptr, sample.priority, volume, pan, glm::vec3(NaN), NaN, true);
 }
 
 
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, volume, position, half_volume_radius, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+Sound::PlayingHandle Sound::loop_3D(Sample const &sample, float volume, glm::vec3 const &position, float half_volume_radius) {
+	return start(&sample, nullptr, sample.priority, volume, NaN, position, half_volume_radius, true);
 }
 
 
+//helper: start a stream (with a bit already decoded, so playback doesn't start with a gap):
+static Sound::PlayingHandle start_stream(Sound::StreamingSample const &sample, float volume, float pan, bool loop) {
+	std::shared_ptr< Sound::Stream > stream = std::make_shared< Sound::Stream >(sample.filename, loop);
+	stream->fill(4 * MIX_SAMPLES);
+	return start(nullptr, stream, sample.priority, volume, pan, glm::vec3(NaN), NaN, loop);
+}
+
+Sound::PlayingHandle Sound::play(StreamingSample const &sample, float volume, float pan) {
+	return start_stream(sample, volume, pan, false);
+}
+
+Sound::PlayingHandle Sound::loop(StreamingSample const &sample, float volume, float pan) {
+	return start_stream(sample, volume, pan, true);
+}
+
 void Sound::stop_all_samples() {
-	lock();
-	for (auto &s : playing_samples) {
-		s->stop();
-	}
-	unlock();
+	post_sample(Command::StopAll, Sound::PlayingHandle(), glm::vec3(0.0f), 1.0f / 60.0f);
 }
 
 void Sound::set_volume(float new_volume, float ramp) {
-	lock();
-	volume.set(new_volume, ramp);
-	unlock();
+	post_sample(Command::SetGlobalVolume, Sound::PlayingHandle(), glm::vec3(new_volume), ramp);
+}
+
+void Sound::set_max_voices(uint32_t count) {
+	max_voices.store(std::min(std::max(count, 1U), Sound::MAX_PLAYING), std::memory_order_relaxed);
 }
 
 //------------------
+//n.b. these only queue the change; the audio callback applies it (see apply_command, below):
 
-void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
-	Sound::lock();
-	if (!stopping) {
-		volume.set(new_volume, ramp);
-	}
-	Sound::unlock();
+void Sound::PlayingHandle::set_volume(float new_volume, float ramp) const {
+	post_sample(Command::SetVolume, *this, glm::vec3(new_volume), ramp);
 }
 
-void Sound::PlayingSample::set_pan(float new_pan, float ramp) {
-	if (!(pan.value == pan.value)) return; //ignore if not in '2D' mode
-	Sound::lock();
-	pan.set(new_pan, ramp);
-	Sound::unlock();
+void Sound::PlayingHandle::set_pan(float new_pan, float ramp) const {
+	post_sample(Command::SetPan, *this, glm::vec3(new_pan), ramp);
 }
 
-void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	position.set(new_position, ramp);
-	Sound::unlock();
+void Sound::PlayingHandle::set_position(glm::vec3 const &new_position, float ramp) const {
+	post_sample(Command::SetPosition, *this, new_position, ramp);
 }
 
-void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	half_volume_radius.set(new_radius, ramp);
-	Sound::unlock();
+void Sound::PlayingHandle::set_half_volume_radius(float new_radius, float ramp) const {
+	post_sample(Command::SetHalfVolumeRadius, *this, glm::vec3(new_radius), ramp);
 }
 
-void Sound::PlayingSample::stop(float ramp) {
-	Sound::lock();
-	if (!(stopping || stopped)) {
-		stopping = true;
-		volume.target = 0.0f;
-		volume.ramp = ramp;
-	} else {
-		volume.ramp = std::min(volume.ramp, ramp);
-	}
-	Sound::unlock();
+void Sound::PlayingHandle::stop(float ramp) const {
+	post_sample(Command::Stop, *this, glm::vec3(0.0f), ramp);
+}
+
+bool Sound::PlayingHandle::stopped() const {
+	if (index >= MAX_PLAYING) return true;
+	Sound::PlayingSample const &slot = pool[index];
+	//(read 'stopped' first: a reused slot gets its new generation before 'stopped' is cleared)
+	bool slot_stopped = slot.stopped.load();
+	return slot_stopped || slot.generation.load() != generation;
 }
 
 //------------------
 
 void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
-	Sound::lock();
-	position.set(new_position, ramp);
+	Command command;
+	command.type = Command::SetListener;
+	command.value = new_position;
 	//some extra code to make sure right is always a unit vector:
 	if (new_right == glm::vec3(0.0f)) {
-		right.set(glm::vec3(1.0f, 0.0f, 0.0f), ramp);
+		command.right = glm::vec3(1.0f, 0.0f, 0.0f);
 	} else {
-		right.set(glm::normalize(new_right), ramp);
+		command.right = glm::normalize(new_right);
 	}
-	Sound::unlock();
+	command.ramp = ramp;
+	post(std::move(command));
 }
 
 //------------------------ internals --------------------------------
@@ -251,6 +617,79 @@ void compute_pan_from_listener_and_position(
 	}
 }
 
+//helper: apply a change posted by the game thread:
+void apply_command(Command const &command) {
+	//find the slot the command is for (dropping commands for samples that have already stopped):
+	Sound::PlayingSample *sample = nullptr;
+	if (command.index < Sound::MAX_PLAYING) {
+		Sound::PlayingSample &slot = pool[command.index];
+		if (command.type == Command::Play
+		 || (slot.active && slot.generation.load(std::memory_order_relaxed) == command.generation)) {
+			sample = &slot;
+		}
+	}
+	if (!sample && !(command.type == Command::StopAll || command.type == Command::SetListener || command.type == Command::SetGlobalVolume)) return;
+
+	//(2D samples have a non-NaN pan, 3D samples a NaN one)
+	bool is_2D = sample && (sample->pan.value == sample->pan.value);
+	switch (command.type) {
+		case Command::Play:
+			assert(playing_count < Sound::MAX_PLAYING);
+			sample->active = true;
+			playing[playing_count++] = command.index;
+			break;
+		case Command::SetVolume:
+			if (!sample->stopping) sample->volume.set(command.value.x, command.ramp);
+			break;
+		case Command::SetPan:
+			if (is_2D) sample->pan.set(command.value.x, command.ramp);
+			break;
+		case Command::SetPosition:
+			if (!is_2D) sample->position.set(command.value, command.ramp);
+			break;
+		case Command::SetHalfVolumeRadius:
+			if (!is_2D) sample->half_volume_radius.set(command.value.x, command.ramp);
+			break;
+		case Command::Stop:
+			if (!(sample->stopping || sample->stopped)) {
+				sample->stopping = true;
+				sample->volume.target = 0.0f;
+				sample->volume.ramp = command.ramp;
+			} else {
+				sample->volume.ramp = std::min(sample->volume.ramp, command.ramp);
+			}
+			break;
+		case Command::StopAll:
+			for (uint32_t p = 0; p < playing_count; ++p) {
+				Command stop;
+				stop.type = Command::Stop;
+				stop.index = playing[p];
+				stop.generation = pool[playing[p]].generation.load(std::memory_order_relaxed);
+				stop.ramp = command.ramp;
+				apply_command(stop);
+			}
+			break;
+		case Command::SetListener:
+			Sound::listener.position.set(command.value, command.ramp);
+			Sound::listener.right.set(command.right, command.ramp);
+			break;
+		case Command::SetGlobalVolume:
+			Sound::volume.set(command.value.x, command.ramp);
+			break;
+	}
+}
+
+//helper: the audio callback is done with a slot; mark its sample stopped and hand the slot back to the game thread:
+void retire(uint32_t index) {
+	Sound::PlayingSample &slot = pool[index];
+	slot.active = false;
+	if (slot.stream) slot.stream->finished.store(true, std::memory_order_release); //(so the decoder lets go of it)
+	slot.stopped = true;
+	if (!retired.push(uint32_t(index))) {
+		assert(0 && "Retired ring can hold every slot.");
+	}
+}
+
 //helper: ramp updates...
 constexpr float const RAMP_STEP = float(MIX_SAMPLES) / float(AUDIO_RATE);
 
@@ -310,18 +749,152 @@ void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
 }
 
 
+#ifdef SOUND_USE_SSE
+//helper: pan eight mono samples (d0123, d4567) and add them to the four (l,r,l,r) vectors at 'out';
+// pan01 is the pan of the first two frames, step2 / step4 the pan change over two / four frames:
+static inline void mix_8(__m128 d0123, __m128 d4567, __m128 pan01, __m128 step2, __m128 step4, float *out) {
+	//(pans for the other frames are offsets from pan01, so rounding doesn't accumulate within an iteration)
+	__m128 pan23 = _mm_add_ps(pan01, step2);
+	__m128 pan45 = _mm_add_ps(pan01, step4);
+	__m128 pan67 = _mm_add_ps(pan45, step2);
+	_mm_storeu_ps(out + 0, _mm_add_ps(_mm_loadu_ps(out + 0), _mm_mul_ps(pan01, _mm_unpacklo_ps(d0123, d0123))));
+	_mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(pan23, _mm_unpackhi_ps(d0123, d0123))));
+	_mm_storeu_ps(out + 8, _mm_add_ps(_mm_loadu_ps(out + 8), _mm_mul_ps(pan45, _mm_unpacklo_ps(d4567, d4567))));
+	_mm_storeu_ps(out + 12, _mm_add_ps(_mm_loadu_ps(out + 12), _mm_mul_ps(pan67, _mm_unpackhi_ps(d4567, d4567))));
+}
+#endif
+
+void Sound::mix_run(float const *data, uint32_t count, glm::vec2 const &pan, glm::vec2 const &pan_step, float *buffer) {
+	uint32_t k = 0;
+#ifdef SOUND_USE_SSE
+	//eight frames per iteration, as four (l,r,l,r) vectors:
+	//pan of frames k, k+1 as (l,r,l,r):
+	__m128 pan01 = _mm_setr_ps(pan.x, pan.y, pan.x + pan_step.x, pan.y + pan_step.y);
+	__m128 step2 = _mm_setr_ps(2.0f * pan_step.x, 2.0f * pan_step.y, 2.0f * pan_step.x, 2.0f * pan_step.y);
+	__m128 step4 = _mm_add_ps(step2, step2);
+	__m128 step8 = _mm_add_ps(step4, step4);
+	for (; k + 8 <= count; k += 8) {
+		mix_8(_mm_loadu_ps(data + k), _mm_loadu_ps(data + k + 4), pan01, step2, step4, buffer + 2 * k);
+		pan01 = _mm_add_ps(pan01, step8);
+	}
+#endif
+	//remaining frames (all of them without SSE):
+	for (; k < count; ++k) {
+		buffer[2 * k + 0] += (pan.x + float(k) * pan_step.x) * data[k];
+		buffer[2 * k + 1] += (pan.y + float(k) * pan_step.y) * data[k];
+	}
+}
+
+void Sound::mix_run(int16_t const *data, uint32_t count, glm::vec2 const &pan, glm::vec2 const &pan_step, float *buffer) {
+	constexpr float Scale = 1.0f / 32768.0f;
+	uint32_t k = 0;
+#ifdef SOUND_USE_SSE
+	//as above, but converting eight 16-bit samples at a time:
+	__m128 pan01 = _mm_setr_ps(pan.x, pan.y, pan.x + pan_step.x, pan.y + pan_step.y);
+	__m128 step2 = _mm_setr_ps(2.0f * pan_step.x, 2.0f * pan_step.y, 2.0f * pan_step.x, 2.0f * pan_step.y);
+	__m128 step4 = _mm_add_ps(step2, step2);
+	__m128 step8 = _mm_add_ps(step4, step4);
+	__m128 scale = _mm_set1_ps(Scale);
+	for (; k + 8 <= count; k += 8) {
+		__m128i d = _mm_loadu_si128(reinterpret_cast< __m128i const * >(data + k));
+		//sign-extend by putting each 16-bit value in the top half of a 32-bit lane and shifting down:
+		__m128 d0123 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16)), scale);
+		__m128 d4567 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(d, d), 16)), scale);
+		mix_8(d0123, d4567, pan01, step2, step4, buffer + 2 * k);
+		pan01 = _mm_add_ps(pan01, step8);
+	}
+#endif
+	for (; k < count; ++k) {
+		float d = float(data[k]) * Scale;
+		buffer[2 * k + 0] += (pan.x + float(k) * pan_step.x) * d;
+		buffer[2 * k + 1] += (pan.y + float(k) * pan_step.y) * d;
+	}
+}
+
+//helper: decode 'count' samples of an ADPCM sample, starting at 'begin', into 'out':
+static void decode_adpcm(Sound::Sample const &sample, uint32_t begin, uint32_t count, Sound::PlayingSample::ADPCMState *state_, float *out) {
+	assert(state_);
+	auto &state = *state_;
+	constexpr uint32_t BlockSamples = Sound::Sample::ADPCMBlockSamples;
+
+	//the state only follows sequential playback; after a loop or a jump (e.g. while virtual), catch up from the block start:
+	if (state.at != begin) state.at = begin - (begin % BlockSamples);
+
+	auto decode = [&]() {
+		uint32_t in_block = state.at % BlockSamples;
+		uint8_t const *block = sample.adpcm.data() + (state.at / BlockSamples) * Sound::Sample::ADPCMBlockBytes;
+		if (in_block == 0) {
+			state.predictor = int16_t(uint16_t(block[0]) | (uint16_t(block[1]) << 8));
+			state.index = block[2];
+		}
+		uint32_t nibble = (block[4 + in_block / 2] >> ((in_block & 1) * 4)) & 0xf;
+		adpcm_step(nibble, &state.predictor, &state.index);
+		state.at += 1;
+		return state.predictor;
+	};
+
+	while (state.at < begin) decode();
+	for (uint32_t k = 0; k < count; ++k) {
+		out[k] = float(decode()) * (1.0f / 32768.0f);
+	}
+}
+
+void Sound::render(uint32_t blocks, float *buffer, float *block_seconds) {
+	assert(buffer);
+	if (device != 0) {
+		throw std::runtime_error("Sound::render() can't be used while the audio device is open.");
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	for (uint32_t b = 0; b < blocks; ++b) {
+		//apply pending commands first, so newly started streams are waited on too:
+		Command command;
+		while (commands.pop(&command)) {
+			apply_command(command);
+		}
+
+		//wait for every stream to have a full block ready (or to have nothing more to give):
+		for (uint32_t p = 0; p < playing_count; ++p) {
+			Sound::PlayingSample const &playing_sample = pool[playing[p]];
+			if (!playing_sample.stream) continue;
+			Sound::Stream const &stream = *playing_sample.stream;
+			while (!stream.finished.load(std::memory_order_acquire)
+			 && stream.head.load(std::memory_order_acquire) - stream.tail.load(std::memory_order_relaxed) < MIX_SAMPLES) {
+				stream_decoder.wake.notify_one();
+				std::this_thread::yield();
+			}
+		}
+
+		auto before = Clock::now();
+		mix(buffer + b * 2 * MIX_SAMPLES);
+		auto after = Clock::now();
+		if (block_seconds) block_seconds[b] = std::chrono::duration< float >(after - before).count();
+	}
+}
+
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void mix_audio(void *, Uint8 *buffer_, int len) {
 	assert(buffer_); //should always have some audio buffer
+	assert(len == MIX_SAMPLES * 2 * sizeof(float)); //should always have the expected number of samples
+	Sound::mix(reinterpret_cast< float * >(buffer_));
+}
+
+void Sound::mix(float *buffer_) {
+	assert(buffer_);
 
 	struct LR {
 		float l;
 		float r;
 	};
 	static_assert(sizeof(LR) == 8, "Sample is packed");
-	assert(len == MIX_SAMPLES * sizeof(LR)); //should always have the expected number of samples
 	LR *buffer = reinterpret_cast< LR * >(buffer_);
 
+	//pick up everything the game thread has asked for since the last block:
+	Command command;
+	while (commands.pop(&command)) {
+		apply_command(command);
+	}
+
 	//zero the output buffer:
 	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
 		buffer[s].l = 0.0f;
@@ -341,9 +914,18 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
 	glm::vec3 end_position =  Sound::listener.position.value;
 	glm::vec3 end_right =  Sound::listener.right.value;
 
-	//add audio from each playing sample into the buffer:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
+	//figure out how loud each playing sample will be this block:
+	struct Voice {
+		uint32_t index; //slot in the pool
+		LR start_pan, end_pan; //gains (including volume) at the start and end of the block
+		float score; //audibility * priority; louder / more important voices are mixed first
+		bool real; //mix this block?
+	};
+	static std::array< Voice, Sound::MAX_PLAYING > voices; //(only used here, on the audio thread)
+	uint32_t voice_count = playing_count;
+
+	for (uint32_t p = 0; p < playing_count; ++p) {
+		Sound::PlayingSample &playing_sample = pool[playing[p]];
 
 		//Figure out sample panning/volume at start...
 		LR start_pan;
@@ -385,52 +967,131 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
 		end_pan.l *= end_volume * playing_sample.volume.value;
 		end_pan.r *= end_volume * playing_sample.volume.value;
 
-		//figure out a step to add at each sample so that pan will move smoothly from start to end:
-		LR pan = start_pan;
-		LR pan_step;
-		pan_step.l = (end_pan.l - start_pan.l) / MIX_SAMPLES;
-		pan_step.r = (end_pan.r - start_pan.r) / MIX_SAMPLES;
+		float audibility = std::max(std::max(start_pan.l, start_pan.r), std::max(end_pan.l, end_pan.r));
+		voices[p] = (Voice{playing[p], start_pan, end_pan, audibility * playing_sample.priority, audibility >= Sound::INAUDIBLE_GAIN});
+	}
 
-		assert(playing_sample.i < playing_sample.data.size());
+	//only the max_voices highest-scoring audible voices are real; the rest are virtual (advanced, but not mixed):
+	uint32_t const limit = Sound::max_voices.load(std::memory_order_relaxed);
+	uint32_t audible = uint32_t(std::count_if(voices.begin(), voices.begin() + voice_count, [](Voice const &v) { return v.real; }));
+	if (audible > limit) {
+		static std::array< float, Sound::MAX_PLAYING > scores;
+		uint32_t score_count = 0;
+		for (uint32_t v = 0; v < voice_count; ++v) {
+			if (voices[v].real) scores[score_count++] = voices[v].score;
+		}
+		float *scores_end = scores.data() + score_count;
+		std::nth_element(scores.data(), scores.data() + (limit - 1), scores_end, std::greater< float >());
+		float cutoff = scores[limit - 1];
+		uint32_t ties = limit - uint32_t(std::count_if(scores.data(), scores_end, [cutoff](float score) { return score > cutoff; }));
+		for (uint32_t i = 0; i < voice_count; ++i) {
+			Voice &v = voices[i];
+			if (!v.real || v.score > cutoff) continue;
+			if (v.score == cutoff && ties > 0) --ties; //(ties go to the older voice)
+			else v.real = false;
+		}
+	}
 
-		for (uint32_t i = 0; i < MIX_SAMPLES; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-			buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
+	//add audio from each real voice into the buffer (and advance the virtual ones):
+	uint32_t real_count = 0;
+	uint32_t virtual_count = 0;
+	uint32_t kept = 0; //samples still playing after this block (compacted into the front of 'playing')
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		Voice &voice = voices[v];
+		Sound::PlayingSample &playing_sample = pool[voice.index];
+
+		//switching between real and virtual fades over the block, so it doesn't pop:
+		bool mixed = voice.real;
+		if (voice.real) {
+			if (playing_sample.voice == Sound::PlayingSample::Virtual) voice.start_pan = LR{0.0f, 0.0f}; //fade in
+			playing_sample.voice = Sound::PlayingSample::Real;
+		} else {
+			if (playing_sample.voice == Sound::PlayingSample::Real) { //fade out
+				voice.end_pan = LR{0.0f, 0.0f};
+				mixed = true;
+			}
+			playing_sample.voice = Sound::PlayingSample::Virtual;
+		}
+		if (mixed) ++real_count;
+		else ++virtual_count;
 
-			//update position in sample:
-			playing_sample.i += 1;
-			if (playing_sample.i == playing_sample.data.size()) {
-				if (playing_sample.loop) {
-					playing_sample.i = 0;
-				} else {
-					break;
+		//figure out a step to add at each sample so that pan will move smoothly from start to end:
+		LR pan = voice.start_pan;
+		LR pan_step;
+		pan_step.l = (voice.end_pan.l - voice.start_pan.l) / MIX_SAMPLES;
+		pan_step.r = (voice.end_pan.r - voice.start_pan.r) / MIX_SAMPLES;
+
+		bool ended = false; //ran out of data?
+		if (playing_sample.stream) {
+			//streaming: mix whatever the decoder has ready (if it has fallen behind, the rest of the block is silent):
+			Sound::Stream &stream = *playing_sample.stream;
+			bool finished = stream.finished.load(std::memory_order_acquire); //(check before head, so no data can arrive after)
+			uint32_t tail = stream.tail.load(std::memory_order_relaxed);
+			uint32_t available = stream.head.load(std::memory_order_acquire) - tail;
+			uint32_t total = std::min(MIX_SAMPLES, available);
+			for (uint32_t i = 0; mixed && i < total; /* later */) {
+				uint32_t at = (tail + i) & (Sound::Stream::Size - 1);
+				uint32_t count = std::min(total - i, Sound::Stream::Size - at);
+				mix_run(stream.ring.data() + at, count,
+					glm::vec2(pan.l + float(i) * pan_step.l, pan.r + float(i) * pan_step.r),
+					glm::vec2(pan_step.l, pan_step.r),
+					&buffer[i].l);
+				i += count;
+			}
+			stream.tail.store(tail + total, std::memory_order_release);
+			ended = (finished && total == available);
+		} else {
+			Sound::Sample const &sample = *playing_sample.sample;
+			assert(playing_sample.i < sample.length);
+
+			//mix in contiguous runs of sample data, each up to the end of the data (or of the buffer):
+			uint32_t size = sample.length;
+			for (uint32_t i = 0; i < MIX_SAMPLES; /* later */) {
+				uint32_t count = std::min(MIX_SAMPLES - i, size - playing_sample.i);
+				if (mixed) {
+					glm::vec2 run_pan(pan.l + float(i) * pan_step.l, pan.r + float(i) * pan_step.r);
+					if (sample.format == Sound::Sample::Float) {
+						mix_run(sample.data.data() + playing_sample.i, count, run_pan, glm::vec2(pan_step.l, pan_step.r), &buffer[i].l);
+					} else if (sample.format == Sound::Sample::Int16) {
+						mix_run(sample.data16.data() + playing_sample.i, count, run_pan, glm::vec2(pan_step.l, pan_step.r), &buffer[i].l);
+					} else { //ADPCM: decode the run (serial by nature) into a small buffer, then mix that:
+						static float decoded[MIX_SAMPLES]; //(only used here, on the audio thread)
+						decode_adpcm(sample, playing_sample.i, count, &playing_sample.adpcm, decoded);
+						mix_run(decoded, count, run_pan, glm::vec2(pan_step.l, pan_step.r), &buffer[i].l);
+					}
+				}
+				i += count;
+
+				//update position in sample:
+				playing_sample.i += count;
+				if (playing_sample.i == size) {
+					if (playing_sample.loop) {
+						playing_sample.i = 0;
+					} else {
+						break;
+					}
 				}
 			}
-
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
+			ended = (playing_sample.i >= sample.length);
 		}
 
-		if (playing_sample.i >= playing_sample.data.size()
+		if (ended
 		 || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
-		 	playing_sample.stopped = true;
-			//erase from list:
-			auto old = si;
-			++si;
-			playing_samples.erase(old);
+			retire(voice.index);
 		} else {
-			++si;
+			playing[kept++] = voice.index;
 		}
 	}
+	playing_count = kept;
+	Sound::real_voice_count.store(real_count, std::memory_order_relaxed);
+	Sound::virtual_voice_count.store(virtual_count, std::memory_order_relaxed);
 
 	/*//DEBUG: report output power:
 	float max_power = 0.0f;
 	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
 		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
 	}
-	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
+	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_count << std::endl; //DEBUG
 	*/
 
 }
@@ -6,6 +6,8 @@
 #include <vector>
 #include <string>
 #include <cmath>
+#include <atomic>
+#include <cstdint>
 
 //Game audio system. Simplified from f18-base3.
 //Uses 48kHz sampling rate.
@@ -14,17 +16,54 @@ namespace Sound {
 
 //Sample objects hold mono (one-channel) audio.
 struct Sample {
+	//sample data is stored as 48kHz, mono, in one of these formats:
+	enum Format : uint8_t {
+		Float, //32-bit float (in 'data')
+		Int16, //16-bit integer (in 'data16'); half the size, transparent for 16-bit (or lossy) sources
+		ADPCM, //4-bit IMA-ADPCM blocks (in 'adpcm'); about an eighth the size, fine for noisy effects
+		Auto, //(when loading) Int16 for integer or lossy sources, Float otherwise
+	};
+
 	//Load from a '.wav' or '.opus' file.
 	//  will warn and convert if sound is not already 48kHz mono:
-	Sample(std::string const &filename);
+	Sample(std::string const &filename, Format format = Auto);
 	
 	//Directly supply an audio buffer:
-	Sample(std::vector< float > const &data);
+	Sample(std::vector< float > const &data, Format format = Float);
+
+	Format format = Float;
+	uint32_t length = 0; //number of samples (whatever the format)
+	std::vector< float > data; //Float samples
+	std::vector< int16_t > data16; //Int16 samples
+	std::vector< uint8_t > adpcm; //ADPCM blocks: int16 predictor, uint8 step index, one byte padding, then two samples per byte (low nibble first)
+	enum : uint32_t {
+		ADPCMBlockSamples = 1024,
+		ADPCMBlockBytes = 4 + ADPCMBlockSamples / 2,
+	};
+
+	//memory used by the sample data:
+	size_t bytes() const { return data.size() * sizeof(float) + data16.size() * sizeof(int16_t) + adpcm.size(); }
+
+	//(re)fill the storage for 'format' from float samples:
+	void store(std::vector< float > const &data, Format format);
 
-	//sample data is stored as 48kHz, mono, floating-point:
-	std::vector< float > data;
+	//when too many sounds play at once, the quietest (scaled by priority) aren't mixed:
+	float priority = 1.0f;
 };
 
+//StreamingSample objects refer to (long) '.opus' or '.wav' files, e.g. music, that are decoded a bit at a time
+// on a background thread while they play, rather than all at once into memory:
+struct StreamingSample {
+	//checks that the file opens (throws if not); decoding starts when the sample is played:
+	StreamingSample(std::string const &filename);
+
+	std::string filename;
+	float priority = 1.0f; //(as in Sample)
+};
+
+//(internal) audio being decoded for one playback of a StreamingSample:
+struct Stream;
+
 //Ramp<> manages values that should be smoothly interpolated
 //  to a target over a certain amount of time:
 template< typename T >
@@ -48,29 +87,58 @@ struct Ramp {
 	float ramp = 0.0f;
 };
 
-// 'PlayingSample' objects book-keep samples that are currently playing:
-struct PlayingSample {
-	//change the panning or volume of a playing sample (and do proper locking);
+//playing samples live in a fixed pool of this many slots (play() returns an empty handle when all are in use):
+constexpr uint32_t const MAX_PLAYING = 256; //must be a power of two
+
+// 'PlayingHandle' refers to a playing sample by its slot in the pool and that slot's generation,
+//  so it can be copied and kept around freely: once the sample stops and the slot is reused, it does nothing.
+struct PlayingHandle {
+	//change the panning or volume of a playing sample;
 	// value will change over 'ramp' seconds to avoid creating audible artifacts:
-	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
+	void set_volume(float new_volume, float ramp = 1.0f / 60.0f) const;
 	//set the panning of a sample (use only on samples in "2D" mode; no effect on "3D" samples):
-	void set_pan(float new_pan, float ramp = 1.0f / 60.0f);
+	void set_pan(float new_pan, float ramp = 1.0f / 60.0f) const;
 	//set the position of a sample (use only on samples in "3D" mode; no effect on "2D" samples):
-	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f);
+	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f) const;
 	//set the half-volume radius (use only on "3D" playing sounds):
-	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f);
+	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f) const;
 
 	//'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
-	void stop(float ramp = 1.0f / 60.0f);
+	void stop(float ramp = 1.0f / 60.0f) const;
 
-	//internals:
+	//was playback stopped (either by running out of sample, or by stop())? (true for an empty handle)
+	bool stopped() const;
+
+	uint32_t index = -1U; //slot in the pool (-1U: empty handle)
+	uint32_t generation = 0; //the slot's generation when this sample started
+};
+
+// 'PlayingSample' objects (slots of the pool) book-keep samples that are currently playing:
+struct PlayingSample {
 	//NOTE: PlayingSample is used in a separate thread; so setting these values directly
-	// may result in bad results. Instead, use the functions above, which perform locking!
-	std::vector< float > const &data; //reference to sample data being played
+	// may result in bad results. Instead, use the PlayingHandle functions, which queue the change
+	// for the audio callback (they never wait on it).
+	//A slot belongs to the game thread while free (play() fills it in), and to the audio callback
+	// from the Play command until the sample stops (the callback then hands it back).
+	Sample const *sample = nullptr; //sample being played (null if streaming)
+	std::shared_ptr< Stream > stream; //decoded audio of a StreamingSample being played (null if not streaming; only released by the game thread)
 	uint32_t i = 0; //next data value to read
+	struct ADPCMState {
+		uint32_t at = -1U; //sample index the state below decodes next (if not 'i', decoding restarts at i's block)
+		int32_t predictor = 0;
+		int32_t index = 0;
+	} adpcm; //(ADPCM samples only)
 	bool loop = false; //should playback loop after data runs out?
 	bool stopping = false; //is playing stopping?
-	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
+	std::atomic< bool > stopped{true}; //was playback stopped (either by running out of sample, or by stop())? (safe to read from any thread)
+	std::atomic< uint32_t > generation{0}; //bumped each time the slot is reused (written only by the game thread)
+	bool active = false; //is the audio callback playing this slot? (audio callback only)
+	float priority = 1.0f; //copied from the sample
+	enum Voice : uint8_t {
+		New, //not mixed yet
+		Real, //mixed last block
+		Virtual, //advanced but not mixed last block (too quiet, or too many voices)
+	} voice = New;
 
 	Ramp< float > volume = Ramp< float >(1.0f);
 
@@ -80,11 +148,6 @@ struct PlayingSample {
 	//3D playback panning control: ('NaN' if sound played in 2D mode)
 	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
 	Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
-
-	PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), pan(pan_) { }
-	PlayingSample(Sample const &sample_, float volume_, glm::vec3 const &position_, float half_volume_radius_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
 };
 
 // ------- global functions -------
@@ -93,15 +156,24 @@ void init(); //call Sound::init() from main.cpp before using any member function
 
 void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
 
+void update(); //call Sound::update() once per frame (game thread) to free what stopped samples held (e.g. a stream's ring and decoder)
+
 //Call 'Sound::play' to play a sample once.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback early.
-std::shared_ptr< PlayingSample > play(
+//  (an empty Sample has nothing to play; play() and loop() return an empty handle for it)
+PlayingHandle play(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
+//StreamingSamples can be played (2D only) as well; each call decodes its own copy of the stream:
+PlayingHandle play(
+	StreamingSample const &sample,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
 //The play_3D version will play a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > play_3D(
+PlayingHandle play_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
@@ -110,13 +182,19 @@ std::shared_ptr< PlayingSample > play_3D(
 
 //Call 'Sound::loop' to play a sample ~forever~.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback.
-std::shared_ptr< PlayingSample > loop(
+PlayingHandle loop(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
+//Looping a StreamingSample (e.g. background music) rewinds the file whenever it runs out:
+PlayingHandle loop(
+	StreamingSample const &sample,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
 //The loop_3D version will loop a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > loop_3D(
+PlayingHandle loop_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
@@ -140,10 +218,50 @@ void stop_all_samples();
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 extern Ramp< float > volume;
 
+//NOTE: play/stop/set_* are meant to be called from a single (game) thread: they post commands
+// to a single-producer/single-consumer queue that the audio callback drains at the start of each block.
+// Playing samples come from (and go back to) the fixed pool, so starting and stopping them doesn't allocate
+// or free memory on either thread -- except for StreamingSamples: starting one allocates its decoder and ring,
+// which are freed on the game thread (by Sound::update(), or the next play) once it stops.
+
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
-// the set_*/stop/play/... functions already use these helpers, so you shouldn't need
-// to call them unless your code is modifying values directly:
+// the set_*/stop/play/... functions don't need these (they queue their changes instead),
+// so only call them if your code is modifying values directly:
 void lock();
 void unlock();
 
+//---- mixing internals (used by the audio callback; exposed for benchmarks) ----
+
+constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate
+constexpr uint32_t const MIX_SAMPLES = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+
+//voice management: at most max_voices playing samples are mixed per block (highest audibility * priority first);
+// the rest -- and any quieter than INAUDIBLE_GAIN -- are "virtual": they keep their place in the sample but aren't mixed.
+constexpr uint32_t const MAX_VOICES = 32; //default for max_voices
+extern std::atomic< uint32_t > max_voices;
+//change the voice limit (clamped to [1, MAX_PLAYING]; takes effect at the next block; safe to call from any thread):
+void set_max_voices(uint32_t count);
+constexpr float const INAUDIBLE_GAIN = 0.001f; //about -60dB
+
+//voice counts of the last mixed block (for profiling; safe to read from any thread):
+extern std::atomic< uint32_t > real_voice_count;
+extern std::atomic< uint32_t > virtual_voice_count;
+
+//apply queued commands, then mix the next MIX_SAMPLES stereo frames of all playing samples into 'buffer'
+// (interleaved left/right; overwritten) and advance every playing sample; the audio callback calls this:
+void mix(float *buffer);
+
+//offline rendering (no audio device; e.g. for tools and regression tests): mix 'blocks' consecutive blocks
+// into 'buffer' (2 * MIX_SAMPLES * blocks floats, interleaved left/right), optionally recording how long each
+// block took to mix in 'block_seconds' ('blocks' floats). Unlike the device callback, this waits for
+// streaming samples to be decoded, so the output depends only on the sequence of play/stop/set_* calls.
+// Throws if the audio device is open.
+void render(uint32_t blocks, float *buffer, float *block_seconds = nullptr);
+
+//add data[k] * (pan + k * pan_step) to frame k of 'buffer' (interleaved left/right) for k in [0, count):
+// (this is the inner loop of mix(); vectorized where available)
+void mix_run(float const *data, uint32_t count, glm::vec2 const &pan, glm::vec2 const &pan_step, float *buffer);
+//...with 16-bit samples (converted to float on the fly):
+void mix_run(int16_t const *data, uint32_t count, glm::vec2 const &pan, glm::vec2 const &pan_step, float *buffer);
+
 } //namespace Sound
@@ -0,0 +1,381 @@
+#include "TiledWalkMesh.hpp"
+
+#include "read_write_chunk.hpp"
+
+#include <glm/gtx/norm.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <limits>
+#include <algorithm>
+
+//helper: read a chunk header, record where its data starts, and skip the data:
+static std::streamoff skip_chunk(std::istream &from, std::string const &magic, uint32_t element_size) {
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (!from.read(reinterpret_cast< char * >(&header), sizeof(header))) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+	if (header.size % element_size != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	std::streamoff offset = from.tellg();
+	from.seekg(header.size, std::ios::cur);
+	return offset;
+}
+
+//helper: read 'count' elements starting at element 'begin' of the chunk data at 'offset':
+template< typename T >
+static void read_range(std::istream &from, std::streamoff offset, uint32_t begin, uint32_t end, std::vector< T > *to_) {
+	assert(to_);
+	auto &to = *to_;
+	to.resize(end - begin);
+	if (to.empty()) return;
+	from.seekg(offset + std::streamoff(begin) * std::streamoff(sizeof(T)));
+	if (!from.read(reinterpret_cast< char * >(to.data()), to.size() * sizeof(T))) {
+		throw std::runtime_error("Failed to read tile data.");
+	}
+}
+
+TiledWalkMesh::TiledWalkMesh(std::string const &filename_) : filename(filename_) {
+	std::ifstream file(filename, std::ios::binary);
+
+	read_chunk(file, "til0", &tiles);
+
+	vertices_offset = skip_chunk(file, "p...", sizeof(glm::vec3));
+	normals_offset = skip_chunk(file, "n...", sizeof(glm::vec3));
+	triangles_offset = skip_chunk(file, "tri0", sizeof(glm::uvec3));
+	portals_offset = skip_chunk(file, "prt0", sizeof(PortalInfo));
+	std::streamoff tile_bytes = std::streamoff(file.tellg()) - vertices_offset;
+
+	if (!file || file.peek() != EOF) {
+		std::cerr << "WARNING: trailing (or truncated) data in tiled walkmesh file '" << filename << "'" << std::endl;
+	}
+
+	for (auto const &t : tiles) {
+		if (!(t.vertex_begin <= t.vertex_end && t.triangle_begin <= t.triangle_end && t.portal_begin <= t.portal_end)) {
+			throw std::runtime_error("Invalid tile ranges in '" + filename + "'");
+		}
+	}
+
+	resident.resize(tiles.size());
+	requested.assign(tiles.size(), false);
+
+	streaming = (tile_bytes >= StreamingBytes);
+	if (!streaming) {
+		for (uint32_t t = 0; t < tiles.size(); ++t) {
+			resident[t] = read_tile(t);
+		}
+	}
+}
+
+TiledWalkMesh::~TiledWalkMesh() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	if (loader.joinable()) loader.join();
+}
+
+TiledWalkMesh::Resident TiledWalkMesh::read_tile(uint32_t tile) const {
+	assert(tile < tiles.size());
+	TileInfo const &info = tiles[tile];
+
+	std::ifstream file(filename, std::ios::binary);
+
+	std::vector< glm::vec3 > vertices;
+	read_range(file, vertices_offset, info.vertex_begin, info.vertex_end, &vertices);
+	std::vector< glm::vec3 > normals;
+	read_range(file, normals_offset, info.vertex_begin, info.vertex_end, &normals);
+	std::vector< glm::uvec3 > triangles;
+	read_range(file, triangles_offset, info.triangle_begin, info.triangle_end, &triangles);
+	std::vector< PortalInfo > portals;
+	read_range(file, portals_offset, info.portal_begin, info.portal_end, &portals);
+
+	uint32_t count = info.vertex_end - info.vertex_begin;
+	for (auto const &tri : triangles) {
+		if (!(tri.x < count && tri.y < count && tri.z < count)) {
+			throw std::runtime_error("Invalid triangle in tile of '" + filename + "'");
+		}
+	}
+
+	Resident res;
+	res.mesh = std::make_unique< WalkMesh >(vertices, normals, triangles);
+	res.portals.reserve(portals.size());
+	for (auto const &p : portals) {
+		if (!(p.tile < tiles.size() && p.a0 < count && p.a1 < count)) {
+			throw std::runtime_error("Invalid portal in tile of '" + filename + "'");
+		}
+		res.portals.emplace(glm::uvec2(p.a0, p.a1), Portal{p.tile, glm::uvec2(p.b0, p.b1)});
+	}
+	return res;
+}
+
+void TiledWalkMesh::load() {
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		wake.wait(lock, [&]() { return quit || !requests.empty(); });
+		if (quit) return;
+		uint32_t tile = requests.back();
+		requests.pop_back();
+
+		lock.unlock();
+		Resident res;
+		std::string failed;
+		try {
+			res = read_tile(tile);
+		} catch (std::exception &e) {
+			failed = e.what();
+		}
+		lock.lock();
+
+		if (failed.empty()) loaded.emplace_back(tile, std::move(res));
+		else if (error.empty()) error = failed;
+	}
+}
+
+void TiledWalkMesh::update_resident(glm::vec3 const &center, float radius, bool wait) {
+	if (!streaming) return; //(every tile was read when the file was opened)
+
+	//install tiles the loader has finished (and pick up its errors):
+	if (loader.joinable()) {
+		arrived.clear();
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			if (!error.empty()) {
+				std::string failed = error;
+				error.clear();
+				throw std::runtime_error(failed);
+			}
+			arrived.swap(loaded);
+		}
+		for (auto &[tile, res] : arrived) {
+			if (!requested[tile]) continue; //(unwanted again since it was asked for)
+			requested[tile] = false;
+			resident[tile] = std::move(res);
+		}
+	}
+
+	//which tiles are wanted only depends on the tile under 'center', so there is nothing to do until that changes:
+	glm::vec2 at = glm::vec2(center);
+	auto over = [&at](TileInfo const &info) {
+		return info.min.x <= at.x && at.x <= info.max.x && info.min.y <= at.y && at.y <= info.max.y;
+	};
+	if (!wait && center_tile < tiles.size() && over(tiles[center_tile])) return;
+
+	center_tile = -1U;
+	for (uint32_t t = 0; t < tiles.size(); ++t) {
+		if (over(tiles[t])) {
+			center_tile = t;
+			break;
+		}
+	}
+	//(off of every tile, the wanted region is just the center point, and it is rescanned every call)
+	glm::vec2 region_min = (center_tile < tiles.size() ? tiles[center_tile].min : at);
+	glm::vec2 region_max = (center_tile < tiles.size() ? tiles[center_tile].max : at);
+
+	float radius2 = radius * radius;
+	wanted.clear();
+	for (uint32_t t = 0; t < tiles.size(); ++t) {
+		//gap between the region and the tile's bounds:
+		glm::vec2 gap = glm::max(glm::max(tiles[t].min - region_max, region_min - tiles[t].max), glm::vec2(0.0f));
+		bool want = glm::length2(gap) <= radius2;
+
+		if (want && !resident[t].mesh) {
+			if (wait) {
+				resident[t] = read_tile(t);
+				requested[t] = false; //(a queued copy that arrives later is dropped)
+			} else if (!requested[t]) {
+				requested[t] = true;
+				wanted.emplace_back(t);
+			}
+		} else if (!want) {
+			resident[t].mesh.reset();
+			resident[t].portals.clear();
+			requested[t] = false;
+		}
+	}
+
+	if (!wanted.empty()) {
+		{
+			std::unique_lock< std::mutex > lock(mutex);
+			if (!loader.joinable()) loader = std::thread([this]() { load(); });
+			requests.insert(requests.end(), wanted.begin(), wanted.end());
+		}
+		wake.notify_one();
+	}
+}
+
+WalkMesh const &TiledWalkMesh::tile_mesh(uint32_t tile) const {
+	if (!is_resident(tile)) {
+		throw std::runtime_error("Tile " + std::to_string(tile) + " of '" + filename + "' is not resident.");
+	}
+	return *resident[tile].mesh;
+}
+
+WalkPoint TiledWalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+	for (uint32_t t = 0; t < resident.size(); ++t) {
+		if (!resident[t].mesh || resident[t].mesh->triangles.empty()) continue;
+		WalkPoint wp = resident[t].mesh->nearest_walk_point(world_point);
+		float dis2 = glm::length2(world_point - resident[t].mesh->to_world_point(wp));
+		if (dis2 < closest_dis2) {
+			closest_dis2 = dis2;
+			closest = wp;
+			closest.tile = t;
+		}
+	}
+	assert(closest_dis2 != std::numeric_limits< float >::infinity() && "Cannot start on a walkmesh with no resident tiles");
+	return closest;
+}
+
+void TiledWalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end, float *time) const {
+	assert(end);
+	tile_mesh(start.tile).walk_in_triangle(start, step, end, time);
+	end->tile = start.tile;
+}
+
+bool TiledWalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *rotation_) const {
+	assert(end_);
+	auto &end = *end_;
+
+	assert(rotation_);
+	auto &rotation = *rotation_;
+
+	//internal edge of this tile?
+	WalkMesh const &from = tile_mesh(start.tile);
+	if (from.cross_edge(start, &end, &rotation)) return true;
+
+	//portal to another tile?
+	auto const &portals = resident[start.tile].portals;
+	auto f = portals.find(glm::uvec2(start.indices.x, start.indices.y));
+	if (f == portals.end()) return false; //true boundary
+	if (!is_resident(f->second.tile)) return false; //tile not streamed in; treat as a wall for now
+
+	WalkMesh const &to = *resident[f->second.tile].mesh;
+	auto n = to.next_vertex.find(f->second.edge);
+	if (n == to.next_vertex.end()) return false; //(shouldn't happen in a well-formed file)
+
+	end = start;
+	end.tile = f->second.tile;
+	end.indices.x = f->second.edge.x;
+	end.indices.y = f->second.edge.y;
+	end.indices.z = n->second;
+	end.weights.x = start.weights.y;
+	end.weights.y = start.weights.x;
+	end.weights.z = 0.0f;
+
+	glm::vec3 n0 = from.to_world_triangle_normal(start);
+	glm::vec3 n1 = to.to_world_triangle_normal(end);
+	rotation = glm::rotation(n0, n1);
+
+	return true;
+}
+
+void TiledWalkMesh::write(WalkMesh const &mesh, float tile_size, std::ostream *to_) {
+	assert(to_);
+	assert(tile_size > 0.0f);
+
+	//assign triangles to grid cells by centroid:
+	std::map< std::pair< int32_t, int32_t >, uint32_t > cell_to_tile;
+	std::vector< std::vector< uint32_t > > tile_triangles;
+	std::vector< uint32_t > triangle_tile(mesh.triangles.size());
+	for (uint32_t ti = 0; ti < mesh.triangles.size(); ++ti) {
+		glm::uvec3 const &tri = mesh.triangles[ti];
+		glm::vec3 centroid = (mesh.vertices[tri.x] + mesh.vertices[tri.y] + mesh.vertices[tri.z]) / 3.0f;
+		std::pair< int32_t, int32_t > cell(
+			int32_t(std::floor(centroid.x / tile_size)),
+			int32_t(std::floor(centroid.y / tile_size))
+		);
+		auto ret = cell_to_tile.emplace(cell, uint32_t(tile_triangles.size()));
+		if (ret.second) tile_triangles.emplace_back();
+		triangle_tile[ti] = ret.first->second;
+		tile_triangles[ret.first->second].emplace_back(ti);
+	}
+
+	std::vector< TileInfo > infos(tile_triangles.size());
+	std::vector< glm::vec3 > vertices;
+	std::vector< glm::vec3 > normals;
+	std::vector< glm::uvec3 > triangles;
+	std::vector< PortalInfo > portals;
+
+	//copy vertices/triangles, remapping to tile-local indices:
+	std::vector< std::unordered_map< uint32_t, uint32_t > > local(tile_triangles.size());
+	for (uint32_t t = 0; t < tile_triangles.size(); ++t) {
+		TileInfo &info = infos[t];
+		info.min = glm::vec2( std::numeric_limits< float >::infinity());
+		info.max = glm::vec2(-std::numeric_limits< float >::infinity());
+		info.vertex_begin = uint32_t(vertices.size());
+		info.triangle_begin = uint32_t(triangles.size());
+		auto remap = [&](uint32_t v) -> uint32_t {
+			auto ret = local[t].emplace(v, uint32_t(vertices.size() - info.vertex_begin));
+			if (ret.second) {
+				vertices.emplace_back(mesh.vertices[v]);
+				normals.emplace_back(mesh.normals[v]);
+				info.min = glm::min(info.min, glm::vec2(mesh.vertices[v]));
+				info.max = glm::max(info.max, glm::vec2(mesh.vertices[v]));
+			}
+			return ret.first->second;
+		};
+		for (uint32_t ti : tile_triangles[t]) {
+			glm::uvec3 const &tri = mesh.triangles[ti];
+			uint32_t a = remap(tri.x);
+			uint32_t b = remap(tri.y);
+			uint32_t c = remap(tri.z);
+			triangles.emplace_back(a, b, c);
+		}
+		info.vertex_end = uint32_t(vertices.size());
+		info.triangle_end = uint32_t(triangles.size());
+	}
+
+	//edges whose triangle on the other side is in a different tile become portals:
+	std::unordered_map< glm::uvec2, uint32_t > edge_triangle;
+	edge_triangle.reserve(mesh.triangles.size() * 3);
+	for (uint32_t ti = 0; ti < mesh.triangles.size(); ++ti) {
+		glm::uvec3 const &tri = mesh.triangles[ti];
+		edge_triangle.emplace(glm::uvec2(tri.x, tri.y), ti);
+		edge_triangle.emplace(glm::uvec2(tri.y, tri.z), ti);
+		edge_triangle.emplace(glm::uvec2(tri.z, tri.x), ti);
+	}
+	for (uint32_t t = 0; t < tile_triangles.size(); ++t) {
+		infos[t].portal_begin = uint32_t(portals.size());
+		for (uint32_t ti : tile_triangles[t]) {
+			glm::uvec3 const &tri = mesh.triangles[ti];
+			auto check_edge = [&](uint32_t a, uint32_t b) {
+				auto f = edge_triangle.find(glm::uvec2(b, a));
+				if (f == edge_triangle.end()) return;
+				uint32_t other = triangle_tile[f->second];
+				if (other == t) return;
+				PortalInfo portal;
+				portal.a0 = local[t].at(a);
+				portal.a1 = local[t].at(b);
+				portal.tile = other;
+				portal.b0 = local[other].at(b);
+				portal.b1 = local[other].at(a);
+				portals.emplace_back(portal);
+			};
+			check_edge(tri.x, tri.y);
+			check_edge(tri.y, tri.z);
+			check_edge(tri.z, tri.x);
+		}
+		infos[t].portal_end = uint32_t(portals.size());
+	}
+
+	write_chunk("til0", infos, to_);
+	write_chunk("p...", vertices, to_);
+	write_chunk("n...", normals, to_);
+	write_chunk("tri0", triangles, to_);
+	write_chunk("prt0", portals, to_);
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+/*
+ * A "TiledWalkMesh" splits a large walk surface into tiles on an xy grid.
+ * Only tiles near the player need to be resident; the rest stay on disk.
+ *
+ * Each tile is an ordinary WalkMesh over its own (tile-local) vertices.
+ * Edges shared with a neighboring tile are stored as "portals", so that
+ * cross_edge() hops between tiles without the caller noticing.
+ *
+ * The walking interface mirrors WalkMesh, with WalkPoint::tile recording
+ * which tile a WalkPoint's indices refer to.
+ *
+ * Tiles are read from disk on a background thread: update_resident() asks
+ * for the tiles near the player and installs whichever have finished loading,
+ * so walking never waits on a file read (a tile that hasn't arrived yet acts
+ * like a wall until it does).
+ *
+ * Files with little tile data (see StreamingBytes) aren't worth streaming:
+ * all of their tiles are read when the file is opened, and no loader thread
+ * is ever started.
+ *
+ */
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+
+struct TiledWalkMesh {
+	//open a tiled walkmesh file (".wt"); reads only the tile index:
+	// note: will throw if file fails to read.
+	TiledWalkMesh(std::string const &filename);
+	~TiledWalkMesh();
+	TiledWalkMesh(TiledWalkMesh const &) = delete;
+
+	//split a monolithic walkmesh into tiles of (roughly) tile_size x tile_size and write in the ".wt" format:
+	static void write(WalkMesh const &mesh, float tile_size, std::ostream *to);
+
+	//want tiles whose bounds come within 'radius' (in xy) of the bounds of the tile 'center' is over, and unload all others:
+	// (call every frame or so with the player's position; radius should be comfortably larger than a step)
+	// The tiles are only rescanned when 'center' moves off of that tile.
+	// Missing tiles are queued for the loader thread and installed by a later call;
+	// with 'wait', they are read right away instead (e.g. when placing the player on a new level).
+	// Rethrows loading errors from the loader thread.
+	void update_resident(glm::vec3 const &center, float radius, bool wait = false);
+
+	bool is_resident(uint32_t tile) const { return tile < resident.size() && resident[tile].mesh != nullptr; }
+
+	//look up a resident tile's mesh; will throw if tile is not resident:
+	WalkMesh const &tile_mesh(uint32_t tile) const;
+
+	//same as WalkMesh's versions, but over all resident tiles:
+	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
+
+	void walk_in_triangle(
+		WalkPoint const &start,   //[in] starting location on triangle
+		glm::vec3 const &step,    //[in] step to take (in world space). Will be projected to triangle.
+		WalkPoint *end,           //[out] final position in triangle
+		float *time               //[out] time at which edge is encountered, or 1.0 if whole step is within triangle
+	) const;
+
+	//traverse over a triangle edge, which may be a portal into another tile:
+	//  returns false (like a boundary edge) if the tile across the portal is not resident
+	bool cross_edge(
+		WalkPoint const &start, //[in] walkpoint on triangle edge
+		WalkPoint *end,         //[out] end walkpoint, having crossed edge
+		glm::quat *rotation     //[out] rotation over edge
+	) const;
+
+	glm::vec3 to_world_point(WalkPoint const &wp) const { return tile_mesh(wp.tile).to_world_point(wp); }
+	glm::vec3 to_world_smooth_normal(WalkPoint const &wp) const { return tile_mesh(wp.tile).to_world_smooth_normal(wp); }
+	glm::vec3 to_world_triangle_normal(WalkPoint const &wp) const { return tile_mesh(wp.tile).to_world_triangle_normal(wp); }
+
+	//-- internals ---
+
+	//tile index entry (as stored in the file):
+	struct TileInfo {
+		glm::vec2 min, max; //xy bounds of tile's vertices
+		uint32_t vertex_begin, vertex_end;
+		uint32_t triangle_begin, triangle_end;
+		uint32_t portal_begin, portal_end;
+	};
+	static_assert(sizeof(TileInfo) == 4*2*2 + 4*6, "TileInfo is packed.");
+	std::vector< TileInfo > tiles;
+
+	//portal edge (as stored in the file):
+	// edge (a0,a1) of this tile is edge (b1,b0) of tile 'tile' (so b0 is the same vertex as a1, b1 as a0)
+	struct PortalInfo {
+		uint32_t a0, a1;
+		uint32_t tile;
+		uint32_t b0, b1;
+	};
+	static_assert(sizeof(PortalInfo) == 4*5, "PortalInfo is packed.");
+
+	//where across a portal edge leads:
+	struct Portal {
+		uint32_t tile;
+		glm::uvec2 edge; //edge in 'tile' (already reversed; i.e., (b0,b1))
+	};
+
+	struct Resident {
+		std::unique_ptr< WalkMesh > mesh; //nullptr if tile is not loaded
+		std::unordered_map< glm::uvec2, Portal > portals; //indexed by (a0,a1)
+	};
+	std::vector< Resident > resident;
+	std::vector< bool > requested; //queued for (or being read by) the loader thread
+
+	//files with less tile data than this are read whole when opened:
+	static constexpr std::streamoff StreamingBytes = 256 * 1024;
+	bool streaming = false;
+
+	uint32_t center_tile = -1U; //tile whose bounds held 'center' at the last rescan (-1U if none)
+	std::vector< uint32_t > wanted; //scratch space for update_resident
+	std::vector< std::pair< uint32_t, Resident > > arrived; //scratch space for update_resident
+
+	//where tile data lives in the file:
+	std::string filename;
+	std::streamoff vertices_offset = 0;
+	std::streamoff normals_offset = 0;
+	std::streamoff triangles_offset = 0;
+	std::streamoff portals_offset = 0;
+
+	//read a tile from the file (only reads members that don't change after construction, so is safe on the loader thread):
+	Resident read_tile(uint32_t tile) const;
+
+	//loader thread:
+	std::thread loader;
+	std::mutex mutex;
+	std::condition_variable wake; //loader waits on this for requests (or quit)
+	std::vector< uint32_t > requests; //tiles to read (guarded by mutex)
+	std::vector< std::pair< uint32_t, Resident > > loaded; //tiles read, waiting to be installed (guarded by mutex)
+	std::string error; //first loading error, rethrown by update_resident (guarded by mutex)
+	bool quit = false; //(guarded by mutex)
+	void load(); //loader thread body
+};
@@ -0,0 +1,441 @@
+#include "TriangleBVH.hpp"
+
+#include <glm/gtx/hash.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+	// closest point to p on triangle abc (Ericson 5.1.5)
+	glm::vec3 closest_point_triangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+	{
+		glm::vec3 ab = b - a;
+		glm::vec3 ac = c - a;
+		glm::vec3 ap = p - a;
+		float d1 = glm::dot(ab, ap);
+		float d2 = glm::dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f) { return a; }
+
+		glm::vec3 bp = p - b;
+		float d3 = glm::dot(ab, bp);
+		float d4 = glm::dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3) { return b; }
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) { return a + ab * (d1 / (d1 - d3)); }
+
+		glm::vec3 cp = p - c;
+		float d5 = glm::dot(ab, cp);
+		float d6 = glm::dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6) { return c; }
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) { return a + ac * (d2 / (d2 - d6)); }
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) { return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))); }
+
+		float denom = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
+	}
+
+	// closest points c1 on p1-q1 and c2 on p2-q2 (Ericson 5.1.9)
+	void closest_points_segments(const glm::vec3& p1, const glm::vec3& q1, const glm::vec3& p2, const glm::vec3& q2, glm::vec3* c1, glm::vec3* c2)
+	{
+		const float eps = 1e-12f;
+		glm::vec3 d1 = q1 - p1;
+		glm::vec3 d2 = q2 - p2;
+		glm::vec3 r = p1 - p2;
+		float a = glm::dot(d1, d1);
+		float e = glm::dot(d2, d2);
+		float f = glm::dot(d2, r);
+		float s, t;
+		if (a <= eps && e <= eps)
+		{
+			s = t = 0.0f;
+		}
+		else if (a <= eps)
+		{
+			s = 0.0f;
+			t = glm::clamp(f / e, 0.0f, 1.0f);
+		}
+		else
+		{
+			float c = glm::dot(d1, r);
+			if (e <= eps)
+			{
+				t = 0.0f;
+				s = glm::clamp(-c / a, 0.0f, 1.0f);
+			}
+			else
+			{
+				float b = glm::dot(d1, d2);
+				float denom = a * e - b * b;
+				s = (denom != 0.0f ? glm::clamp((b * f - c * e) / denom, 0.0f, 1.0f) : 0.0f);
+				t = (b * s + f) / e;
+				if (t < 0.0f)
+				{
+					t = 0.0f;
+					s = glm::clamp(-c / a, 0.0f, 1.0f);
+				}
+				else if (t > 1.0f)
+				{
+					t = 1.0f;
+					s = glm::clamp((b - c) / a, 0.0f, 1.0f);
+				}
+			}
+		}
+		*c1 = p1 + d1 * s;
+		*c2 = p2 + d2 * t;
+	}
+
+	// two-sided ray/triangle intersection (Moller-Trumbore); *t is along 'dir'
+	bool ray_triangle(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float* t)
+	{
+		glm::vec3 ab = b - a;
+		glm::vec3 ac = c - a;
+		glm::vec3 p = glm::cross(dir, ac);
+		float det = glm::dot(ab, p);
+		if (std::abs(det) < 1e-12f) { return false; }
+		float inv_det = 1.0f / det;
+		glm::vec3 s = origin - a;
+		float u = glm::dot(s, p) * inv_det;
+		if (u < 0.0f || u > 1.0f) { return false; }
+		glm::vec3 q = glm::cross(s, ab);
+		float v = glm::dot(dir, q) * inv_det;
+		if (v < 0.0f || u + v > 1.0f) { return false; }
+		*t = glm::dot(ac, q) * inv_det;
+		return true;
+	}
+
+	// closest points between segment p-q and triangle abc; returns squared distance
+	float closest_segment_triangle(const glm::vec3& p, const glm::vec3& q, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+		glm::vec3* on_segment, glm::vec3* on_triangle)
+	{
+		// segment passes through the triangle:
+		float t;
+		if (ray_triangle(p, q - p, a, b, c, &t) && t >= 0.0f && t <= 1.0f)
+		{
+			*on_segment = *on_triangle = p + (q - p) * t;
+			return 0.0f;
+		}
+		// otherwise the closest pair involves a segment endpoint and the triangle face, or the segment and a triangle edge:
+		float best = std::numeric_limits<float>::infinity();
+		auto consider = [&](const glm::vec3& s, const glm::vec3& tri) {
+			float d2 = glm::dot(s - tri, s - tri);
+			if (d2 < best)
+			{
+				best = d2;
+				*on_segment = s;
+				*on_triangle = tri;
+			}
+		};
+		consider(p, closest_point_triangle(p, a, b, c));
+		consider(q, closest_point_triangle(q, a, b, c));
+		glm::vec3 s, e;
+		closest_points_segments(p, q, a, b, &s, &e); consider(s, e);
+		closest_points_segments(p, q, b, c, &s, &e); consider(s, e);
+		closest_points_segments(p, q, c, a, &s, &e); consider(s, e);
+		return best;
+	}
+
+	float distance2_point_box(const glm::vec3& p, const glm::vec3& min, const glm::vec3& max)
+	{
+		glm::vec3 d = glm::max(glm::max(min - p, p - max), glm::vec3(0.0f));
+		return glm::dot(d, d);
+	}
+
+	bool boxes_overlap(const glm::vec3& min_a, const glm::vec3& max_a, const glm::vec3& min_b, const glm::vec3& max_b)
+	{
+		return min_a.x <= max_b.x && min_b.x <= max_a.x
+			&& min_a.y <= max_b.y && min_b.y <= max_a.y
+			&& min_a.z <= max_b.z && min_b.z <= max_a.z;
+	}
+
+	// ray vs node bounds (slab test); returns entry distance, or infinity on a miss
+	float ray_box(const glm::vec3& origin, const glm::vec3& inv_dir, float max_t, const glm::vec3& min, const glm::vec3& max)
+	{
+		glm::vec3 t0 = (min - origin) * inv_dir;
+		glm::vec3 t1 = (max - origin) * inv_dir;
+		glm::vec3 lo = glm::min(t0, t1);
+		glm::vec3 hi = glm::max(t0, t1);
+		float enter = std::max(std::max(lo.x, lo.y), std::max(lo.z, 0.0f));
+		float exit = std::min(std::min(hi.x, hi.y), std::min(hi.z, max_t));
+		return (enter <= exit ? enter : std::numeric_limits<float>::infinity());
+	}
+}
+
+namespace
+{
+	// is the triangle soup a closed surface? (after welding coincident positions, every edge is shared by exactly two triangles)
+	bool is_closed(const std::vector<glm::vec3>& positions)
+	{
+		std::unordered_map<glm::ivec3, uint32_t> welded;
+		auto weld = [&welded](const glm::vec3& p) {
+			glm::ivec3 key = glm::ivec3(glm::round(p * 1.0e4f)); // (0.1mm grid)
+			return welded.emplace(key, uint32_t(welded.size())).first->second;
+		};
+		std::unordered_map<glm::uvec2, uint32_t> edge_uses;
+		for (uint32_t i = 0; i + 2 < positions.size(); i += 3)
+		{
+			uint32_t v[3] = { weld(positions[i]), weld(positions[i + 1]), weld(positions[i + 2]) };
+			for (uint32_t k = 0; k < 3; ++k)
+			{
+				uint32_t a = v[k], b = v[(k + 1) % 3];
+				if (a == b) { continue; } // (degenerate triangle)
+				edge_uses[glm::uvec2(std::min(a, b), std::max(a, b))] += 1;
+			}
+		}
+		if (edge_uses.empty()) { return false; }
+		for (const auto& edge : edge_uses)
+		{
+			if (edge.second != 2) { return false; }
+		}
+		return true;
+	}
+}
+
+Collision::TriangleBVH::TriangleBVH(const std::vector<glm::vec3>& positions)
+{
+	if (positions.size() % 3 != 0)
+	{
+		throw std::runtime_error("TriangleBVH needs three positions per triangle.");
+	}
+	uint32_t count = uint32_t(positions.size() / 3);
+	if (count == 0) { return; }
+
+	closed = is_closed(positions);
+
+	std::vector<uint32_t> order(count);
+	std::vector<glm::vec3> centroids(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		order[i] = i;
+		centroids[i] = (positions[3 * i + 0] + positions[3 * i + 1] + positions[3 * i + 2]) / 3.0f;
+	}
+
+	// top-down build, splitting each node at the median centroid along its widest centroid axis
+	nodes.reserve(2 * (count / LeafSize + 1));
+	nodes.emplace_back();
+	struct Task { uint32_t node, begin, end; };
+	std::vector<Task> tasks;
+	tasks.push_back(Task{ 0, 0, count });
+	while (!tasks.empty())
+	{
+		Task task = tasks.back();
+		tasks.pop_back();
+
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
+		glm::vec3 cmin = min, cmax = max;
+		for (uint32_t i = task.begin; i < task.end; ++i)
+		{
+			for (uint32_t k = 0; k < 3; ++k)
+			{
+				min = glm::min(min, positions[3 * order[i] + k]);
+				max = glm::max(max, positions[3 * order[i] + k]);
+			}
+			cmin = glm::min(cmin, centroids[order[i]]);
+			cmax = glm::max(cmax, centroids[order[i]]);
+		}
+		nodes[task.node].min = min;
+		nodes[task.node].max = max;
+
+		glm::vec3 extent = cmax - cmin;
+		int axis = (extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2));
+		if (task.end - task.begin <= LeafSize || extent[axis] == 0.0f)
+		{
+			nodes[task.node].first = task.begin;
+			nodes[task.node].count = task.end - task.begin;
+			continue;
+		}
+
+		uint32_t mid = task.begin + (task.end - task.begin) / 2;
+		std::nth_element(order.begin() + task.begin, order.begin() + mid, order.begin() + task.end, [&](uint32_t a, uint32_t b) {
+			return centroids[a][axis] < centroids[b][axis];
+		});
+
+		uint32_t left = uint32_t(nodes.size());
+		nodes.emplace_back();
+		nodes.emplace_back();
+		nodes[task.node].first = left;
+		nodes[task.node].count = 0;
+		tasks.push_back(Task{ left, task.begin, mid });
+		tasks.push_back(Task{ left + 1, mid, task.end });
+	}
+
+	// store triangles in leaf order:
+	triangles.reserve(positions.size());
+	for (uint32_t i : order)
+	{
+		triangles.emplace_back(positions[3 * i + 0]);
+		triangles.emplace_back(positions[3 * i + 1]);
+		triangles.emplace_back(positions[3 * i + 2]);
+	}
+}
+
+Collision::AABB Collision::TriangleBVH::bounds() const
+{
+	if (nodes.empty()) { return AABB(glm::vec3(0.0f), glm::vec3(0.0f)); }
+	return AABB(0.5f * (nodes[0].min + nodes[0].max), 0.5f * (nodes[0].max - nodes[0].min));
+}
+
+bool Collision::TriangleBVH::raycast(const glm::vec3& origin, const glm::vec3& direction, float max_t,
+	float* t_, glm::vec3* normal, uint32_t* triangle) const
+{
+	if (nodes.empty()) { return false; }
+
+	glm::vec3 inv_dir = 1.0f / direction;
+	float best = max_t;
+	uint32_t best_triangle = -1U;
+
+	uint32_t stack[64];
+	uint32_t top = 0;
+	if (ray_box(origin, inv_dir, best, nodes[0].min, nodes[0].max) == std::numeric_limits<float>::infinity()) { return false; }
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				float t;
+				if (ray_triangle(origin, direction, triangles[3 * i], triangles[3 * i + 1], triangles[3 * i + 2], &t) && t >= 0.0f && t <= best)
+				{
+					best = t;
+					best_triangle = i;
+				}
+			}
+			continue;
+		}
+		// visit the nearer child first (so push it last):
+		float t_left = ray_box(origin, inv_dir, best, nodes[node.first].min, nodes[node.first].max);
+		float t_right = ray_box(origin, inv_dir, best, nodes[node.first + 1].min, nodes[node.first + 1].max);
+		uint32_t near_child = node.first, far_child = node.first + 1;
+		if (t_right < t_left)
+		{
+			std::swap(t_left, t_right);
+			std::swap(near_child, far_child);
+		}
+		if (t_right != std::numeric_limits<float>::infinity()) { stack[top++] = far_child; }
+		if (t_left != std::numeric_limits<float>::infinity()) { stack[top++] = near_child; }
+	}
+
+	if (best_triangle == -1U) { return false; }
+	*t_ = best;
+	if (normal)
+	{
+		const glm::vec3* tri = &triangles[3 * best_triangle];
+		*normal = glm::normalize(glm::cross(tri[1] - tri[0], tri[2] - tri[0]));
+		if (glm::dot(*normal, direction) > 0.0f) { *normal = -*normal; } // face the ray
+	}
+	if (triangle) { *triangle = best_triangle; }
+	return true;
+}
+
+bool Collision::TriangleBVH::contains(const glm::vec3& point) const
+{
+	if (!closed) { return false; } // (parity means nothing for an open surface)
+	if (distance2_point_box(point, nodes[0].min, nodes[0].max) > 0.0f) { return false; }
+
+	// skewed so the ray doesn't run along the edges and faces of axis-aligned meshes:
+	const glm::vec3 direction = glm::normalize(glm::vec3(0.1234f, 0.2345f, 0.9643f));
+	glm::vec3 inv_dir = 1.0f / direction;
+	float max_t = glm::length(nodes[0].max - nodes[0].min); // from inside the bounds, every crossing is within this
+
+	uint32_t crossings = 0;
+	uint32_t stack[64];
+	uint32_t top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (node.count > 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				float t;
+				if (ray_triangle(point, direction, triangles[3 * i], triangles[3 * i + 1], triangles[3 * i + 2], &t) && t >= 0.0f) { ++crossings; }
+			}
+			continue;
+		}
+		if (ray_box(point, inv_dir, max_t, nodes[node.first].min, nodes[node.first].max) != std::numeric_limits<float>::infinity()) { stack[top++] = node.first; }
+		if (ray_box(point, inv_dir, max_t, nodes[node.first + 1].min, nodes[node.first + 1].max) != std::numeric_limits<float>::infinity()) { stack[top++] = node.first + 1; }
+	}
+	return (crossings & 1) != 0;
+}
+
+namespace
+{
+	// shared traversal for the sphere and capsule tests: visits every triangle whose node overlaps [min, max],
+	// 'closest(tri, &on_shape, &on_tri)' returns the squared distance between the core shape (point or segment) and the triangle
+	template<typename Closest>
+	bool bvh_contact(const Collision::TriangleBVH& bvh, const glm::vec3& min, const glm::vec3& max, float radius,
+		Closest const& closest, Collision::Contact* contact)
+	{
+		if (bvh.nodes.empty()) { return false; }
+		float best = radius * radius;
+		bool found = false;
+
+		uint32_t stack[64];
+		uint32_t top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Collision::TriangleBVH::Node& node = bvh.nodes[stack[--top]];
+			if (!boxes_overlap(node.min, node.max, min, max)) { continue; }
+			if (node.count == 0)
+			{
+				stack[top++] = node.first;
+				stack[top++] = node.first + 1;
+				continue;
+			}
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				const glm::vec3* tri = &bvh.triangles[3 * i];
+				glm::vec3 on_shape, on_tri;
+				float d2 = closest(tri, &on_shape, &on_tri);
+				if (d2 > best || (found && d2 == best)) { continue; }
+				found = true;
+				best = d2;
+				if (!contact) { return true; } // caller only wants a yes/no
+				float distance = std::sqrt(d2);
+				contact->point = on_tri;
+				contact->depth = radius - distance;
+				contact->triangle = i;
+				if (distance > 0.0f)
+				{
+					contact->normal = (on_shape - on_tri) / distance;
+				}
+				else
+				{
+					// shape's core touches the surface; fall back to the face normal
+					contact->normal = glm::normalize(glm::cross(tri[1] - tri[0], tri[2] - tri[0]));
+				}
+			}
+		}
+		return found;
+	}
+}
+
+bool Collision::TriangleBVH::testSphere(const glm::vec3& center, float radius, Contact* contact) const
+{
+	return bvh_contact(*this, center - glm::vec3(radius), center + glm::vec3(radius), radius,
+		[&center](const glm::vec3* tri, glm::vec3* on_shape, glm::vec3* on_tri) {
+			*on_shape = center;
+			*on_tri = closest_point_triangle(center, tri[0], tri[1], tri[2]);
+			return glm::dot(center - *on_tri, center - *on_tri);
+		}, contact);
+}
+
+bool Collision::TriangleBVH::testCapsule(const glm::vec3& a, const glm::vec3& b, float radius, Contact* contact) const
+{
+	return bvh_contact(*this, glm::min(a, b) - glm::vec3(radius), glm::max(a, b) + glm::vec3(radius), radius,
+		[&a, &b](const glm::vec3* tri, glm::vec3* on_shape, glm::vec3* on_tri) {
+			return closest_segment_triangle(a, b, tri[0], tri[1], tri[2], on_shape, on_tri);
+		}, contact);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+/*
+ * Triangle-accurate collision shape for a mesh:
+ * a bounding volume hierarchy over a triangle soup held in CPU memory
+ * (e.g. the world-space triangles MeshBuffer keeps for selected meshes).
+ * based on: Real-time Collision Detection by Christer Ericson (chapters 5 and 6)
+ */
+
+// example on how to use:
+// MeshBuffer buffer(data_path("level.pnct"), [](std::string const &name) { return name.find("o_") != std::string::npos; });
+// Collision::TriangleBVH bvh(buffer.positions.at("o_rock"));
+// Collision::Contact contact;
+// if (bvh.testCapsule(feet, head, 0.4f, &contact)) { position += contact.normal * contact.depth; }
+
+#include "Collision.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+namespace Collision
+{
+	// where a query shape touches a mesh:
+	struct Contact
+	{
+		glm::vec3 point;    // closest point on the mesh
+		glm::vec3 normal;   // unit vector from the mesh toward the query shape
+		float depth;        // how far the shape reaches past that point (radius - distance)
+		uint32_t triangle;  // index into TriangleBVH::triangles / 3
+	};
+
+	struct TriangleBVH
+	{
+		TriangleBVH() = default;
+		// build from a triangle soup (three vertices per triangle):
+		TriangleBVH(const std::vector<glm::vec3>& positions);
+
+		// first hit along origin + t * direction for t in [0, max_t] (triangles are two-sided):
+		bool raycast(const glm::vec3& origin, const glm::vec3& direction, float max_t,
+			float* t, glm::vec3* normal = nullptr, uint32_t* triangle = nullptr) const;
+		// is 'point' inside the mesh? (parity of the crossings along a ray; always false unless the mesh is closed)
+		bool contains(const glm::vec3& point) const;
+
+		// do these shapes touch the surface? *contact (optional) gets the deepest contact:
+		bool testSphere(const glm::vec3& center, float radius, Contact* contact = nullptr) const;
+		// capsule: every point within 'radius' of the segment a-b
+		bool testCapsule(const glm::vec3& a, const glm::vec3& b, float radius, Contact* contact = nullptr) const;
+
+		// bounding box of the whole mesh (e.g. for broadphase structures):
+		AABB bounds() const;
+
+		// internals:
+		struct Node
+		{
+			glm::vec3 min;
+			uint32_t first; // leaf: first triangle; interior: left child (the right child is first + 1)
+			glm::vec3 max;
+			uint32_t count; // leaf: number of triangles; interior: 0
+		};
+		static_assert(sizeof(Node) == 32, "Node is packed.");
+		enum : uint32_t { LeafSize = 4 };
+
+		bool closed = false; // every edge shared by exactly two triangles (after welding positions), so inside/outside makes sense
+		std::vector<Node> nodes;
+		std::vector<glm::vec3> triangles; // three vertices per triangle, reordered so each leaf's triangles are contiguous
+	};
+}
@@ -10,9 +10,31 @@
 #include <algorithm>
 #include <string>
 
-WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_)
-	: vertices(vertices_), normals(normals_), triangles(triangles_) {
+//storage owned by WalkMeshes constructed by copying arrays:
+namespace {
+	struct WalkMeshArrays {
+		std::vector< glm::vec3 > vertices;
+		std::vector< glm::vec3 > normals;
+		std::vector< glm::uvec3 > triangles;
+	};
+}
+
+WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_) {
+	auto arrays = std::make_shared< WalkMeshArrays >(WalkMeshArrays{vertices_, normals_, triangles_});
+	vertices = ArrayView< glm::vec3 >(arrays->vertices);
+	normals = ArrayView< glm::vec3 >(arrays->normals);
+	triangles = ArrayView< glm::uvec3 >(arrays->triangles);
+	storage = arrays;
+
+	build_next_vertex();
+}
+
+WalkMesh::WalkMesh(std::shared_ptr< void const > storage_, ArrayView< glm::vec3 > vertices_, ArrayView< glm::vec3 > normals_, ArrayView< glm::uvec3 > triangles_)
+	: vertices(vertices_), normals(normals_), triangles(triangles_), storage(std::move(storage_)) {
+	build_next_vertex();
+}
 
+void WalkMesh::build_next_vertex() {
 	//construct next_vertex map (maps each edge to the next vertex in the triangle):
 	next_vertex.reserve(triangles.size()*3);
 	auto do_next = [this](uint32_t a, uint32_t b, uint32_t c) {
@@ -278,21 +300,170 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 	return true;
 }
 
+bool WalkMesh::walk_segment(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end_, float *traveled_) const {
+	assert(end_);
+	auto &end = *end_;
+
+	end = start;
+	glm::vec3 remain = step;
+	float done = 0.0f;
+	bool reached = false;
+
+	//every edge crossing enters a new triangle, so a straight walk never needs more steps than there are triangles:
+	for (size_t iter = 0; iter <= triangles.size(); ++iter) {
+		if (remain == glm::vec3(0.0f)) {
+			reached = true;
+			break;
+		}
+		WalkPoint next;
+		float time;
+		walk_in_triangle(end, remain, &next, &time);
+		end = next;
+		done += (1.0f - done) * time;
+		if (time == 1.0f) {
+			reached = true;
+			break;
+		}
+		remain *= (1.0f - time);
+
+		//try to step over edge; stop if it's a wall:
+		glm::quat rotation;
+		if (!cross_edge(end, &next, &rotation)) break;
+		end = next;
+		remain = rotation * remain;
+	}
+
+	if (traveled_) *traveled_ = (reached ? 1.0f : done);
+	return reached;
+}
+
+bool WalkMesh::line_of_sight(WalkPoint const &start, glm::vec3 const &target) const {
+	WalkPoint end;
+	return walk_segment(start, target - to_world_point(start), &end);
+}
+
+template< typename Visit >
+bool WalkMesh::walk_xy(glm::uvec3 *tri_, glm::vec2 const &from, glm::vec2 const &to, Visit const &visit) const {
+	assert(tri_);
+	auto &tri = *tri_;
+
+	//twice the signed area of (a,b,p); positive when p is left of a->b (i.e., inside for a CCW triangle edge):
+	auto side = [](glm::vec2 const &a, glm::vec2 const &b, glm::vec2 const &p) {
+		return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+	};
+
+	float t = 0.0f; //how far along from->to the walk has reached
+	for (size_t iter = 0; iter <= triangles.size(); ++iter) {
+		if (visit(tri)) return true;
+
+		//find the edge (u,v) through which the segment leaves this triangle:
+		glm::uvec2 exit_edge = glm::uvec2(-1U);
+		float exit_t = 1.0f;
+		auto check_edge = [&](uint32_t ui, uint32_t vi) {
+			glm::vec2 u = glm::vec2(vertices[ui]);
+			glm::vec2 v = glm::vec2(vertices[vi]);
+			float s0 = side(u, v, from);
+			float ds = side(u, v, to) - s0;
+			if (ds >= 0.0f) return; //segment isn't heading out through this edge
+			float et = std::max(t, s0 / -ds);
+			if (et < exit_t) {
+				exit_t = et;
+				exit_edge = glm::uvec2(ui, vi);
+			}
+		};
+		check_edge(tri.x, tri.y);
+		check_edge(tri.y, tri.z);
+		check_edge(tri.z, tri.x);
+
+		if (exit_edge.x == -1U) return true; //segment ends in this triangle
+		t = exit_t;
+
+		auto f = next_vertex.find(glm::uvec2(exit_edge.y, exit_edge.x));
+		if (f == next_vertex.end()) return false; //boundary edge
+		tri = glm::uvec3(exit_edge.y, exit_edge.x, f->second);
+	}
+	return false;
+}
+
+bool WalkMesh::raycast(WalkPoint const &hint, glm::vec3 const &origin, glm::vec3 const &direction, float max_t, WalkPoint *hit_, float *t_) const {
+	assert(hit_);
+	auto &hit = *hit_;
+
+	float best_t = std::numeric_limits< float >::infinity();
+
+	//ray-triangle test (Moller-Trumbore); records the hit if it is closer than any so far:
+	auto test = [&](glm::uvec3 const &tri) {
+		glm::vec3 const &a = vertices[tri.x];
+		glm::vec3 const &b = vertices[tri.y];
+		glm::vec3 const &c = vertices[tri.z];
+		glm::vec3 ba = b - a;
+		glm::vec3 ca = c - a;
+		glm::vec3 p = glm::cross(direction, ca);
+		float det = glm::dot(ba, p);
+		if (std::abs(det) < 1e-8f) return false; //ray is parallel to triangle
+		float inv_det = 1.0f / det;
+		glm::vec3 o = origin - a;
+		float u = glm::dot(o, p) * inv_det;
+		if (u < 0.0f || u > 1.0f) return false;
+		glm::vec3 q = glm::cross(o, ba);
+		float v = glm::dot(direction, q) * inv_det;
+		if (v < 0.0f || u + v > 1.0f) return false;
+		float t = glm::dot(ca, q) * inv_det;
+		if (t < 0.0f || t > max_t || t >= best_t) return false;
+		best_t = t;
+		hit = WalkPoint(tri, glm::vec3(1.0f - u - v, u, v));
+		return true;
+	};
+
+	glm::uvec3 tri = hint.indices;
+	glm::vec2 ray_from = glm::vec2(origin);
+	glm::vec2 ray_to = glm::vec2(origin + max_t * direction);
+
+	//find the triangle under the ray origin by walking over from the hint:
+	if (walk_xy(&tri, glm::vec2(to_world_point(hint)), ray_from, [](glm::uvec3 const &) { return false; })) {
+		//walk along the ray's shadow, testing each triangle it passes over (first hit is the nearest):
+		walk_xy(&tri, ray_from, ray_to, test);
+	} else {
+		//origin isn't reachable from the hint without crossing a boundary (e.g., a concave outline); test everything:
+		for (auto const &t : triangles) {
+			test(t);
+		}
+	}
+
+	if (best_t == std::numeric_limits< float >::infinity()) return false;
+	if (t_) *t_ = best_t;
+	return true;
+}
+
 
 WalkMeshes::WalkMeshes(std::string const &filename) {
-	std::ifstream file(filename, std::ios::binary);
+	//read the whole file with one allocation; chunks are then used in-place:
+	data = std::make_shared< std::vector< char > >();
+	{
+		std::ifstream file(filename, std::ios::binary | std::ios::ate);
+		if (!file) {
+			throw std::runtime_error("Failed to open walkmesh file '" + filename + "'");
+		}
+		data->resize(size_t(file.tellg()));
+		file.seekg(0);
+		if (!file.read(data->data(), data->size())) {
+			throw std::runtime_error("Failed to read walkmesh file '" + filename + "'");
+		}
+	}
 
-	std::vector< glm::vec3 > vertices;
-	read_chunk(file, "p...", &vertices);
+	size_t offset = 0;
 
-	std::vector< glm::vec3 > normals;
-	read_chunk(file, "n...", &normals);
+	size_t vertices_count = 0;
+	glm::vec3 const *vertices = view_chunk< glm::vec3 >(*data, "p...", &offset, &vertices_count);
 
-	std::vector< glm::uvec3 > triangles;
-	read_chunk(file, "tri0", &triangles);
+	size_t normals_count = 0;
+	glm::vec3 const *normals = view_chunk< glm::vec3 >(*data, "n...", &offset, &normals_count);
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	size_t triangles_count = 0;
+	glm::uvec3 *triangles = view_chunk< glm::uvec3 >(*data, "tri0", &offset, &triangles_count);
+
+	size_t names_count = 0;
+	char const *names = view_chunk< char >(*data, "str0", &offset, &names_count);
 
 	struct IndexEntry {
 		uint32_t name_begin, name_end;
@@ -300,52 +471,82 @@ WalkMeshes::WalkMeshes(std::string const &filename) {
 		uint32_t triangle_begin, triangle_end;
 	};
 
+	//(the string chunk before this can be any length, so the index is copied rather than viewed)
 	std::vector< IndexEntry > index;
-	read_chunk(file, "idxA", &index);
+	copy_chunk(*data, "idxA", &offset, &index);
 
-	if (file.peek() != EOF) {
+	if (offset != data->size()) {
 		std::cerr << "WARNING: trailing data in walkmesh file '" << filename << "'" << std::endl;
 	}
 
 	//-----------------
 
-	if (vertices.size() != normals.size()) {
+	if (vertices_count != normals_count) {
 		throw std::runtime_error("Mis-matched position and normal sizes in '" + filename + "'");
 	}
 
-	for (auto const &e : index) {
-		if (!(e.name_begin <= e.name_end && e.name_end <= names.size())) {
+	//triangles are remapped (in-place) to be relative to their mesh's first vertex;
+	// remap_base remembers what was subtracted, so a later mesh sharing those triangles can recover the originals:
+	std::vector< uint32_t > remap_base(triangles_count, -1U);
+
+	//a mesh that shares triangles with an earlier one gets its own copy of them (kept alive along with the file data):
+	struct CopiedTriangles {
+		std::shared_ptr< std::vector< char > > data;
+		std::vector< glm::uvec3 > triangles;
+	};
+
+	for (IndexEntry const &e : index) {
+		if (!(e.name_begin <= e.name_end && e.name_end <= names_count)) {
 			throw std::runtime_error("Invalid name indices in index of '" + filename + "'");
 		}
-		if (!(e.vertex_begin <= e.vertex_end && e.vertex_end <= vertices.size())) {
+		if (!(e.vertex_begin <= e.vertex_end && e.vertex_end <= vertices_count)) {
 			throw std::runtime_error("Invalid vertex indices in index of '" + filename + "'");
 		}
-		if (!(e.triangle_begin <= e.triangle_end && e.triangle_end <= triangles.size())) {
+		if (!(e.triangle_begin <= e.triangle_end && e.triangle_end <= triangles_count)) {
 			throw std::runtime_error("Invalid triangle indices in index of '" + filename + "'");
 		}
 
-		//copy vertices/normals:
-		std::vector< glm::vec3 > wm_vertices(vertices.begin() + e.vertex_begin, vertices.begin() + e.vertex_end);
-		std::vector< glm::vec3 > wm_normals(normals.begin() + e.vertex_begin, normals.begin() + e.vertex_end);
-
-		//remap triangles:
-		std::vector< glm::uvec3 > wm_triangles; wm_triangles.reserve(e.triangle_end - e.triangle_begin);
+		bool shared = false;
 		for (uint32_t ti = e.triangle_begin; ti != e.triangle_end; ++ti) {
-			if (!( (e.vertex_begin <= triangles[ti].x && triangles[ti].x < e.vertex_end)
-			    && (e.vertex_begin <= triangles[ti].y && triangles[ti].y < e.vertex_end)
-			    && (e.vertex_begin <= triangles[ti].z && triangles[ti].z < e.vertex_end) )) {
+			glm::uvec3 tri = triangles[ti];
+			if (remap_base[ti] != -1U) {
+				tri += glm::uvec3(remap_base[ti]);
+				shared = true;
+			}
+			if (!( (e.vertex_begin <= tri.x && tri.x < e.vertex_end)
+			    && (e.vertex_begin <= tri.y && tri.y < e.vertex_end)
+			    && (e.vertex_begin <= tri.z && tri.z < e.vertex_end) )) {
 				throw std::runtime_error("Invalid triangle in '" + filename + "'");
 			}
-			wm_triangles.emplace_back(
-				triangles[ti].x - e.vertex_begin,
-				triangles[ti].y - e.vertex_begin,
-				triangles[ti].z - e.vertex_begin
-			);
 		}
-		
-		std::string name(names.begin() + e.name_begin, names.begin() + e.name_end);
 
-		auto ret = meshes.emplace(name, WalkMesh(wm_vertices, wm_normals, wm_triangles));
+		std::shared_ptr< void const > storage = data;
+		ArrayView< glm::uvec3 > mesh_triangles;
+		if (!shared) {
+			for (uint32_t ti = e.triangle_begin; ti != e.triangle_end; ++ti) {
+				triangles[ti] -= glm::uvec3(e.vertex_begin);
+				remap_base[ti] = e.vertex_begin;
+			}
+			mesh_triangles = ArrayView< glm::uvec3 >(triangles + e.triangle_begin, e.triangle_end - e.triangle_begin);
+		} else {
+			auto copied = std::make_shared< CopiedTriangles >();
+			copied->data = data;
+			copied->triangles.reserve(e.triangle_end - e.triangle_begin);
+			for (uint32_t ti = e.triangle_begin; ti != e.triangle_end; ++ti) {
+				uint32_t base = (remap_base[ti] == -1U ? 0 : remap_base[ti]);
+				copied->triangles.emplace_back(triangles[ti] + glm::uvec3(base) - glm::uvec3(e.vertex_begin));
+			}
+			mesh_triangles = ArrayView< glm::uvec3 >(copied->triangles);
+			storage = copied;
+		}
+
+		std::string name(names + e.name_begin, names + e.name_end);
+
+		auto ret = meshes.emplace(name, WalkMesh(storage,
+			ArrayView< glm::vec3 >(vertices + e.vertex_begin, e.vertex_end - e.vertex_begin),
+			ArrayView< glm::vec3 >(normals + e.vertex_begin, e.vertex_end - e.vertex_begin),
+			mesh_triangles
+		));
 		if (!ret.second) {
 			throw std::runtime_error("WalkMesh with duplicated name '" + name + "' in '" + filename + "'");
 		}
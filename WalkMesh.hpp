@@ -5,6 +5,7 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <unordered_map>
 
 //"WalkPoint" represents location on the WalkMesh as barycentric coordinates on a triangle:
@@ -14,22 +15,53 @@ struct WalkPoint {
 	//barycentric coordinates for current point:
 	glm::vec3 weights = glm::vec3(std::numeric_limits< float >::quiet_NaN());
 	//NOTE: by convention, if WalkPoint is on an edge, indices/weights will be arranged so that weights.z will be 0.0.
+	//tile that 'indices' refer to (only used by TiledWalkMesh; always zero for a plain WalkMesh):
+	uint32_t tile = 0;
 	WalkPoint(glm::uvec3 const &indices_, glm::vec3 const &weights_) : indices(indices_), weights(weights_) { }
 	WalkPoint() = default;
 };
 
+//"ArrayView" is a non-owning, read-only view of a contiguous array (stand-in for C++20's std::span):
+template< typename T >
+struct ArrayView {
+	ArrayView() = default;
+	ArrayView(T const *data_, size_t size_) : ptr(data_), count(size_) { }
+	ArrayView(std::vector< T > const &vec) : ptr(vec.data()), count(vec.size()) { }
+
+	T const &operator[](size_t i) const { return ptr[i]; }
+	T const *data() const { return ptr; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T const *begin() const { return ptr; }
+	T const *end() const { return ptr + count; }
+
+	T const *ptr = nullptr;
+	size_t count = 0;
+};
+
 struct WalkMesh {
 	//Walk mesh will keep track of triangles, vertices:
-	std::vector< glm::vec3 > vertices;
-	std::vector< glm::vec3 > normals; //normals for interpolated 'up' direction
-	std::vector< glm::uvec3 > triangles; //CCW-oriented
+	// (these are views into 'storage', which may be shared by all the WalkMeshes loaded from one file;
+	//  a mesh whose triangles overlap an earlier mesh's in the file gets its own copy of them)
+	ArrayView< glm::vec3 > vertices;
+	ArrayView< glm::vec3 > normals; //normals for interpolated 'up' direction
+	ArrayView< glm::uvec3 > triangles; //CCW-oriented
+
+	//keeps the memory referenced by the views above alive:
+	std::shared_ptr< void const > storage;
 
 	//This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each triangle (a,b,c), and is useful for checking what's over an edge from a given point:
 	std::unordered_map< glm::uvec2, uint32_t > next_vertex;
 
-	//Construct new WalkMesh and build next_vertex structure:
+	//Construct new WalkMesh (copying the supplied arrays) and build next_vertex structure:
 	WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_);
 
+	//Construct new WalkMesh referencing arrays held by 'storage' (no copies) and build next_vertex structure:
+	WalkMesh(std::shared_ptr< void const > storage_, ArrayView< glm::vec3 > vertices_, ArrayView< glm::vec3 > normals_, ArrayView< glm::uvec3 > triangles_);
+
+	//(used by the constructors) fill in next_vertex from triangles:
+	void build_next_vertex();
+
 	//used to initialize walking -- finds the closest point on the walk mesh:
 	// (should only need to call this at the start of a level)
 	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
@@ -64,6 +96,42 @@ struct WalkMesh {
 		glm::quat *rotation     //[out] rotation over edge
 	) const;
 
+	//walk straight along the surface (like walk_in_triangle + cross_edge, but without sliding along walls):
+	//  if the whole step could be taken:
+	//   - *end will be the position after stepping
+	//   - function returns true
+	//  if a boundary edge was reached first:
+	//   - *end will be the position on that edge
+	//   - function returns false
+	//  cost is proportional to the number of triangles crossed
+	bool walk_segment(
+		WalkPoint const &start,   //[in] starting location
+		glm::vec3 const &step,    //[in] step to take (in world space). Will be projected to each triangle in turn.
+		WalkPoint *end,           //[out] final position
+		float *traveled = nullptr //[out, optional] fraction of the step that was completed
+	) const;
+
+	//is the straight surface path from 'start' toward 'target' free of boundary edges?
+	// (useful for AI visibility checks)
+	bool line_of_sight(WalkPoint const &start, glm::vec3 const &target) const;
+
+	//cast a ray against the walk mesh:
+	//  triangles are visited by walking the ray's xy-projection from 'hint' (a nearby WalkPoint, e.g. the player's)
+	//  so cost is proportional to the number of triangles crossed, not the size of the mesh.
+	//  if the ray hits the surface within [0, max_t]:
+	//   - *hit is the hit location
+	//   - *t (optional) is the ray parameter of the hit
+	//   - function returns true
+	//  NOTE: assumes the mesh is (mostly) a height field; overhangs may be missed.
+	bool raycast(
+		WalkPoint const &hint,       //[in] walkpoint to start the triangle walk from
+		glm::vec3 const &origin,     //[in] ray origin (world space)
+		glm::vec3 const &direction,  //[in] ray direction (world space)
+		float max_t,                 //[in] maximum ray parameter to consider
+		WalkPoint *hit,              //[out] hit location
+		float *t = nullptr           //[out, optional] ray parameter at hit
+	) const;
+
 	//used to read back results of walking:
 	glm::vec3 to_world_point(WalkPoint const &wp) const {
 		//if you were looking here for the lesson solution, well, here you go:
@@ -90,6 +158,17 @@ struct WalkMesh {
 		return glm::normalize( glm::cross( b-a, c-a ) );
 	}
 
+private:
+	//(used by raycast) walk the xy-projection of the segment from->to over triangles, starting in *tri (which should contain 'from'):
+	//  'visit(tri)' is called on each triangle entered (including the first) and may return true to stop the walk early
+	//  returns false if a boundary edge was reached before 'to'; *tri is left as the last triangle visited
+	template< typename Visit >
+	bool walk_xy(
+		glm::uvec3 *tri,
+		glm::vec2 const &from,
+		glm::vec2 const &to,
+		Visit const &visit
+	) const;
 };
 
 struct WalkMeshes {
@@ -101,4 +180,7 @@ struct WalkMeshes {
 
 	//internals:
 	std::unordered_map< std::string, WalkMesh > meshes;
+
+	//the whole file, read with one allocation; meshes' arrays point into this:
+	std::shared_ptr< std::vector< char > > data;
 };
@@ -2,18 +2,14 @@
 
 #include "gl_compile_program.hpp"
 
-#ifndef STR
-#define STR2(X) #X
-#define STR(X) STR2(X)
-#endif
-
 BoneVertexColorProgram::BoneVertexColorProgram() {
 	program = gl_compile_program(
 		"#version 330\n"
 		"uniform mat4 object_to_clip;\n"
 		"uniform mat4x3 object_to_light;\n"
 		"uniform mat3 normal_to_light;\n"
-		"uniform mat4x3 bones[" STR(BONE_LIMIT) "];\n"
+		"uniform samplerBuffer bones;\n"
+		"uniform int bones_offset;\n"
 		"layout(location=0) in vec4 Position;\n" //note: layout keyword used to make sure that the location-0 attribute is always bound to something
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -22,17 +18,28 @@ BoneVertexColorProgram::BoneVertexColorProgram() {
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
+		"mat4x3 bone(uint index) {\n" //bone matrices are stored column-major, three texels each
+		"	int at = 3 * (bones_offset + int(index));\n"
+		"	vec4 a = texelFetch(bones, at);\n"
+		"	vec4 b = texelFetch(bones, at + 1);\n"
+		"	vec4 c = texelFetch(bones, at + 2);\n"
+		"	return mat4x3(a.xyz, vec3(a.w, b.xy), vec3(b.zw, c.x), c.yzw);\n"
+		"}\n"
 		"void main() {\n"
+		"	mat4x3 bone_x = bone(BoneIndices.x);\n"
+		"	mat4x3 bone_y = bone(BoneIndices.y);\n"
+		"	mat4x3 bone_z = bone(BoneIndices.z);\n"
+		"	mat4x3 bone_w = bone(BoneIndices.w);\n"
 		"	vec3 blended_Position = \n"
-		"		( BoneWeights.x * bones[ BoneIndices.x ]\n"
-		"		+ BoneWeights.y * bones[ BoneIndices.y ]\n"
-		"		+ BoneWeights.z * bones[ BoneIndices.z ]\n"
-		"		+ BoneWeights.w * bones[ BoneIndices.w ] ) * Position;\n"
+		"		( BoneWeights.x * bone_x\n"
+		"		+ BoneWeights.y * bone_y\n"
+		"		+ BoneWeights.z * bone_z\n"
+		"		+ BoneWeights.w * bone_w ) * Position;\n"
 		"	vec3 blended_Normal = \n"
-		"		( BoneWeights.x * mat3(bones[ BoneIndices.x ])\n"
-		"		+ BoneWeights.y * mat3(bones[ BoneIndices.y ])\n"
-		"		+ BoneWeights.z * mat3(bones[ BoneIndices.z ])\n"
-		"		+ BoneWeights.w * mat3(bones[ BoneIndices.w ]) ) * Normal;\n" //<-- note: not correct if bones do scaling
+		"		( BoneWeights.x * mat3(bone_x)\n"
+		"		+ BoneWeights.y * mat3(bone_y)\n"
+		"		+ BoneWeights.z * mat3(bone_z)\n"
+		"		+ BoneWeights.w * mat3(bone_w) ) * Normal;\n" //<-- note: not correct if bones do scaling
 		"	gl_Position = object_to_clip * vec4(blended_Position, 1.0);\n"
 		"	position = object_to_light * vec4(blended_Position, 1.0);\n"
 		"	normal = normal_to_light * blended_Normal;\n"
@@ -82,12 +89,19 @@ BoneVertexColorProgram::BoneVertexColorProgram() {
 	object_to_light_mat4x3 = glGetUniformLocation(program, "object_to_light");
 	normal_to_light_mat3 = glGetUniformLocation(program, "normal_to_light");
 
-	bones_mat4x3_array = glGetUniformLocation(program, "bones");
+	bones_offset_int = glGetUniformLocation(program, "bones_offset");
+	GLuint bones_samplerBuffer = glGetUniformLocation(program, "bones");
 
 	sun_direction_vec3 = glGetUniformLocation(program, "sun_direction");
 	sun_color_vec3 = glGetUniformLocation(program, "sun_color");
 	sky_direction_vec3 = glGetUniformLocation(program, "sky_direction");
 	sky_color_vec3 = glGetUniformLocation(program, "sky_color");
+
+	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
+
+	glUniform1i(bones_samplerBuffer, 0); //set bones to sample from GL_TEXTURE0
+
+	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
 }
 
 Load< BoneVertexColorProgram > bone_vertex_color_program(LoadTagEarly, []() {
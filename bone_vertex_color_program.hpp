@@ -1,8 +1,6 @@
 #include "GL.hpp"
 #include "Load.hpp"
 
-#define BONE_LIMIT 40
-
 struct BoneVertexColorProgram {
 	//opengl program object:
 	GLuint program = 0;
@@ -11,12 +9,15 @@ struct BoneVertexColorProgram {
 	GLuint object_to_clip_mat4 = -1U;
 	GLuint object_to_light_mat4x3 = -1U;
 	GLuint normal_to_light_mat3 = -1U;
-	GLuint bones_mat4x3_array = -1U;
+	GLuint bones_offset_int = -1U; //index of this draw's first bone matrix in the palette
 	GLuint sun_direction_vec3 = -1U;
 	GLuint sun_color_vec3 = -1U;
 	GLuint sky_direction_vec3 = -1U;
 	GLuint sky_color_vec3 = -1U;
 
+	//textures:
+	//TEXTURE0 - GL_TEXTURE_BUFFER of bone matrices (see BonePalette), three RGBA32F texels per mat4x3
+
 	BoneVertexColorProgram();
 };
 
@@ -0,0 +1,92 @@
+#include "Collision.hpp"
+
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <string>
+
+//This file times Collision::AABBSet's batch kernels against the one-pair-at-a-time testCollision path,
+// and checks that both give the same answers.
+//usage: collision-bench [box count] [query count]
+
+int main(int argc, char **argv) {
+	uint32_t box_count = (argc > 1 ? uint32_t(std::stoul(argv[1])) : 1000);
+	uint32_t query_count = (argc > 2 ? uint32_t(std::stoul(argv[2])) : 10000);
+
+	//random boxes scattered over a level-sized area:
+	std::mt19937 mt(0x31415926);
+	std::uniform_real_distribution< float > pos(-50.0f, 50.0f);
+	std::uniform_real_distribution< float > size(0.2f, 3.0f);
+	auto random_box = [&]() {
+		return Collision::AABB(glm::vec3(pos(mt), pos(mt), pos(mt) * 0.05f), glm::vec3(size(mt), size(mt), size(mt)));
+	};
+
+	std::vector< Collision::AABB > boxes;
+	Collision::AABBSet set;
+	for (uint32_t i = 0; i < box_count; ++i) {
+		boxes.emplace_back(random_box());
+		set.push_back(boxes.back());
+	}
+	std::vector< Collision::AABB > queries;
+	for (uint32_t i = 0; i < query_count; ++i) {
+		queries.emplace_back(random_box());
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	auto ms = [](Clock::time_point a, Clock::time_point b) {
+		return std::chrono::duration< double, std::milli >(b - a).count();
+	};
+
+	std::vector< uint32_t > hits, x_side;
+	uint32_t mismatches = 0;
+
+	auto run = [&](std::string const &name, auto scalar, auto batch) {
+		//scalar path: one box at a time, as PlayMode does it:
+		uint64_t scalar_hits = 0;
+		auto before = Clock::now();
+		for (auto const &q : queries) {
+			for (auto const &b : boxes) {
+				scalar_hits += (scalar(b, q) != 0);
+			}
+		}
+		auto after = Clock::now();
+		double scalar_ms = ms(before, after);
+
+		//batch path:
+		uint64_t batch_hits = 0;
+		before = Clock::now();
+		for (auto const &q : queries) {
+			(set.*batch)(q, &hits, &x_side);
+			for (uint32_t w : hits) {
+				while (w) { batch_hits += 1; w &= w - 1; }
+			}
+		}
+		after = Clock::now();
+		double batch_ms = ms(before, after);
+
+		//check every answer (including side classification) against the scalar path:
+		for (auto const &q : queries) {
+			(set.*batch)(q, &hits, &x_side);
+			for (uint32_t i = 0; i < boxes.size(); ++i) {
+				int expected = scalar(boxes[i], q);
+				bool hit = (hits[i / 32] >> (i % 32)) & 1;
+				bool x = (x_side[i / 32] >> (i % 32)) & 1;
+				int got = (hit ? (x ? 1 : 2) : 0);
+				if ((expected != 0) != hit || (name == "3D" && expected != got)) ++mismatches;
+			}
+		}
+
+		std::cout << name << ": " << scalar_hits << " / " << batch_hits << " hits; scalar " << scalar_ms << " ms, batch " << batch_ms << " ms (" << (scalar_ms / batch_ms) << "x)" << std::endl;
+	};
+
+	std::cout << box_count << " boxes, " << query_count << " queries" << std::endl;
+	run("3D", [](Collision::AABB const &a, Collision::AABB const &b) { return Collision::testCollision(a, b); }, &Collision::AABBSet::testAABB);
+	run("XY", [](Collision::AABB const &a, Collision::AABB const &b) { return int(Collision::testCollisionXY(a, b)); }, &Collision::AABBSet::testAABBXY);
+	run("XYStrict", [](Collision::AABB const &a, Collision::AABB const &b) { return int(Collision::testCollisionXYStrict(a, b)); }, &Collision::AABBSet::testAABBXYStrict);
+
+	if (mismatches) {
+		std::cerr << "ERROR: " << mismatches << " results differ between scalar and batch paths." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -8,10 +8,11 @@
 #include <stdexcept>
 #include <iostream>
 
-void load_opus(std::string const &filename, std::vector< float > *data_) {
+void load_opus(std::string const &filename, std::vector< float > *data_, uint32_t *source_bits) {
 	assert(data_);
 	auto &data = *data_;
 	data.clear();
+	if (source_bits) *source_bits = 16;
 
 	std::cout << "loading '" << filename << "'..."; std::cout.flush();
 
@@ -52,3 +53,36 @@ void load_opus(std::string const &filename, std::vector< float > *data_) {
 
 	std::cout << " done." << std::endl;
 }
+
+OpusStreamReader::OpusStreamReader(std::string const &filename_) : filename(filename_) {
+	int err = 0;
+	op = op_open_file(filename.c_str(), &err);
+	if (err != 0 || !op) {
+		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+	}
+}
+
+OpusStreamReader::~OpusStreamReader() {
+	if (op) op_free(op);
+}
+
+uint32_t OpusStreamReader::read(float *data, uint32_t count) {
+	assert(data);
+	pcm.resize(2 * count);
+	//(the stereo buffer is sized so a single read never returns more than 'count' samples)
+	int ret = op_read_float_stereo(op, pcm.data(), int(pcm.size()));
+	if (ret < 0) {
+		throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
+	}
+	for (uint32_t i = 0; i < uint32_t(ret); ++i) {
+		data[i] = (pcm[2*i] + pcm[2*i+1]) * 0.5f; //downmix to mono by averaging
+	}
+	return uint32_t(ret);
+}
+
+void OpusStreamReader::rewind() {
+	int ret = op_pcm_seek(op, 0);
+	if (ret != 0) {
+		throw std::runtime_error("opusfile seek error " + std::to_string(ret) + " rewinding \"" + filename + "\".");
+	}
+}
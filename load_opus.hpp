@@ -2,6 +2,26 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 //Load an opus file as 48kHz floating-point mono; throws on error:
-void load_opus(std::string const &filename, std::vector< float > *data);
+// (*source_bits, if given, gets 16 -- opus is lossy, so no more precision than that is worth keeping)
+void load_opus(std::string const &filename, std::vector< float > *data, uint32_t *source_bits = nullptr);
+
+//Incrementally decode an opus file as 48kHz floating-point mono (e.g., for streaming music);
+// the constructor and read() throw on error:
+struct OggOpusFile;
+struct OpusStreamReader {
+	OpusStreamReader(std::string const &filename);
+	~OpusStreamReader();
+	OpusStreamReader(OpusStreamReader const &) = delete;
+
+	//decode up to 'count' samples into 'data'; returns the number decoded (0 at end of file):
+	uint32_t read(float *data, uint32_t count);
+	//go back to the start of the file:
+	void rewind();
+
+	std::string filename;
+	OggOpusFile *op = nullptr;
+	std::vector< float > pcm; //stereo scratch space for decoding
+};
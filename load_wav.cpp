@@ -1,14 +1,64 @@
 #include "load_wav.hpp"
+#include "resample.hpp"
 
 #include <SDL.h>
 
 #include <iostream>
 #include <cassert>
+#include <cstring>
 #include <algorithm>
 
 constexpr uint32_t AUDIO_RATE = 48000;
 
-void load_wav(std::string const &filename, std::vector< float > *data_) {
+//helper: average the channels of each frame of 'frames' frames into one float, using 'decode' to read a sample from its bytes:
+template< typename Decode >
+static void downmix(Uint8 const *buf, uint32_t frames, uint32_t channels, uint32_t bytes, Decode const &decode, float *out) {
+	float scale = 1.0f / float(channels);
+	for (uint32_t f = 0; f < frames; ++f) {
+		Uint8 const *frame = buf + size_t(f) * channels * bytes;
+		float sum = 0.0f;
+		for (uint32_t c = 0; c < channels; ++c) {
+			sum += decode(frame + c * bytes);
+		}
+		out[f] = sum * scale;
+	}
+}
+
+//helper: assemble 16/32-bit words in either byte order:
+static inline uint16_t le16(Uint8 const *p) { return uint16_t(p[0] | (p[1] << 8)); }
+static inline uint16_t be16(Uint8 const *p) { return uint16_t((p[0] << 8) | p[1]); }
+static inline uint32_t le32(Uint8 const *p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+static inline uint32_t be32(Uint8 const *p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]); }
+static inline float bits_to_float(uint32_t bits) { float f; std::memcpy(&f, &bits, 4); return f; }
+
+//helper: convert 'frames' frames of 'format' audio to floats and downmix them to mono in one pass; returns false for unsupported formats:
+static bool to_mono(Uint8 const *buf, uint32_t frames, uint32_t channels, SDL_AudioFormat format, float *out) {
+	uint32_t bits = SDL_AUDIO_BITSIZE(format);
+	uint32_t bytes = bits / 8;
+	bool big = SDL_AUDIO_ISBIGENDIAN(format);
+	if (SDL_AUDIO_ISFLOAT(format) && bits == 32) {
+		if (big) downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return bits_to_float(be32(p)); }, out);
+		else downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return bits_to_float(le32(p)); }, out);
+	} else if (!SDL_AUDIO_ISFLOAT(format) && bits == 32) {
+		if (big) downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return float(int32_t(be32(p))) * (1.0f / 2147483648.0f); }, out);
+		else downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return float(int32_t(le32(p))) * (1.0f / 2147483648.0f); }, out);
+	} else if (bits == 16 && SDL_AUDIO_ISSIGNED(format)) {
+		if (big) downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return float(int16_t(be16(p))) * (1.0f / 32768.0f); }, out);
+		else downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return float(int16_t(le16(p))) * (1.0f / 32768.0f); }, out);
+	} else if (bits == 16) {
+		if (big) downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return (float(be16(p)) - 32768.0f) * (1.0f / 32768.0f); }, out);
+		else downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return (float(le16(p)) - 32768.0f) * (1.0f / 32768.0f); }, out);
+	} else if (bits == 8 && SDL_AUDIO_ISSIGNED(format)) {
+		downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return float(int8_t(p[0])) * (1.0f / 128.0f); }, out);
+	} else if (bits == 8) {
+		downmix(buf, frames, channels, bytes, [](Uint8 const *p) { return (float(p[0]) - 128.0f) * (1.0f / 128.0f); }, out);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void load_wav(std::string const &filename, std::vector< float > *data_, uint32_t *source_bits) {
 	assert(data_);
 	auto &data = *data_;
 
@@ -20,31 +70,125 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 	if (!have) {
 		throw std::runtime_error("Failed to load WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
 	}
+	SDL_AudioFormat format = have->format;
+	uint32_t bits = SDL_AUDIO_BITSIZE(format);
+	uint32_t channels = std::max< uint32_t >(1, have->channels);
+	uint32_t rate = uint32_t(have->freq);
+	if (source_bits) *source_bits = bits;
 
-	//based on the SDL_AudioCVT example in the docs: https://wiki.libsdl.org/SDL_AudioCVT
-	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, AUDIO_F32SYS, 1, AUDIO_RATE);
-	if (cvt.needed) {
+	if (format != AUDIO_F32SYS || channels != 1 || rate != AUDIO_RATE) {
 		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AUDIO_RATE) + " Hz, float32, mono; converting." << std::endl;
-		cvt.len = audio_len;
-		cvt.buf = (Uint8 *)SDL_malloc(cvt.len * cvt.len_mult);
-		SDL_memcpy(cvt.buf, audio_buf, audio_len);
-		SDL_ConvertAudio(&cvt);
-		int final_size = cvt.len_cvt;
-		assert(final_size >= 0 && final_size <= cvt.len * cvt.len_mult && "Converted audio should fit in buffer.");
-		assert(final_size % 4 == 0 && "Converted audio should consist of 4-byte elements.");
-		data.assign(reinterpret_cast< float * >(cvt.buf), reinterpret_cast< float * >(cvt.buf + final_size));
-		SDL_free(cvt.buf);
-	} else {
-		data.assign(reinterpret_cast< float * >(audio_buf), reinterpret_cast< float * >(audio_buf + audio_len));
+	}
+
+	//convert to float and downmix to mono in one pass:
+	std::vector< float > mono;
+	uint32_t frames = audio_len / ((bits / 8) * channels);
+	mono.resize(frames);
+	if (!to_mono(audio_buf, frames, channels, format, mono.data())) {
+		SDL_FreeWAV(audio_buf);
+		throw std::runtime_error("WAV file '" + filename + "' has an unsupported sample format (" + std::to_string(bits) + " bits).");
 	}
 	SDL_FreeWAV(audio_buf);
 
-	float min = 0.0f;
-	float max = 0.0f;
-	for (auto d : data) {
-		min = std::min(min, d);
-		max = std::max(max, d);
+	//then bring it to the mixing rate:
+	if (rate != AUDIO_RATE) {
+		resample(mono, rate, AUDIO_RATE, &data);
+	} else {
+		data = std::move(mono);
+	}
+}
+
+WavStreamReader::WavStreamReader(std::string const &filename_) : filename(filename_) {
+	rw = SDL_RWFromFile(filename.c_str(), "rb");
+	if (!rw) {
+		throw std::runtime_error("Failed to open WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
+	}
+	auto fail = [&](std::string const &why) {
+		SDL_RWclose(rw);
+		rw = nullptr;
+		throw std::runtime_error("WAV file '" + filename + "' " + why);
+	};
+
+	//walk the RIFF chunks to find the format and the start of the data:
+	Uint8 header[12];
+	if (SDL_RWread(rw, header, 1, 12) != 12 || std::memcmp(header, "RIFF", 4) != 0 || std::memcmp(header + 8, "WAVE", 4) != 0) {
+		fail("isn't a RIFF/WAVE file.");
+	}
+	uint32_t bits = 0;
+	bool have_format = false;
+	while (true) {
+		Uint8 chunk[8];
+		if (SDL_RWread(rw, chunk, 1, 8) != 8) fail("has no data chunk.");
+		uint32_t size = le32(chunk + 4);
+		Sint64 next = SDL_RWtell(rw) + Sint64(size) + Sint64(size & 1); //(chunks are padded to even sizes)
+		if (std::memcmp(chunk, "fmt ", 4) == 0) {
+			Uint8 fmt[40] = { 0 };
+			if (size < 16 || SDL_RWread(rw, fmt, 1, std::min< uint32_t >(size, 40)) != std::min< uint32_t >(size, 40)) fail("has a bad fmt chunk.");
+			uint16_t tag = le16(fmt + 0);
+			channels = le16(fmt + 2);
+			rate = le32(fmt + 4);
+			bits = le16(fmt + 14);
+			if (tag == 0xFFFE && size >= 26) tag = le16(fmt + 24); //WAVE_FORMAT_EXTENSIBLE: the real tag starts the subformat GUID
+			if (tag == 1 && bits == 8) format = AUDIO_U8;
+			else if (tag == 1 && bits == 16) format = AUDIO_S16LSB;
+			else if (tag == 1 && bits == 32) format = AUDIO_S32LSB;
+			else if (tag == 3 && bits == 32) format = AUDIO_F32LSB;
+			else fail("has an unsupported sample format (tag " + std::to_string(tag) + ", " + std::to_string(bits) + " bits).");
+			if (channels == 0 || rate == 0) fail("has no channels or a zero sample rate.");
+			have_format = true;
+		} else if (std::memcmp(chunk, "data", 4) == 0) {
+			if (!have_format) fail("has its data chunk before its fmt chunk.");
+			data_offset = uint64_t(SDL_RWtell(rw));
+			data_frames = size / ((bits / 8) * channels);
+			break;
+		}
+		if (SDL_RWseek(rw, next, RW_SEEK_SET) < 0) fail("ends in the middle of a chunk.");
+	}
+
+	if (rate != AUDIO_RATE) {
+		std::cout << "WAV file '" + filename + "' is " + std::to_string(rate) + " Hz; resampling as it streams." << std::endl;
+		resampler.reset(new StreamResampler(rate, AUDIO_RATE));
+	}
+}
+
+WavStreamReader::~WavStreamReader() {
+	if (rw) SDL_RWclose(rw);
+}
+
+uint32_t WavStreamReader::read(float *data, uint32_t count) {
+	assert(data);
+	uint32_t frame_bytes = (SDL_AUDIO_BITSIZE(format) / 8) * channels;
+
+	//read and convert up to 'want' frames from the file; returns the number converted:
+	auto read_frames = [&](uint32_t want, float *out) -> uint32_t {
+		want = std::min(want, data_frames - frames_read);
+		if (want == 0) return 0;
+		raw.resize(size_t(want) * frame_bytes);
+		size_t got = SDL_RWread(rw, raw.data(), frame_bytes, want);
+		if (got != want) {
+			throw std::runtime_error("WAV file '" + filename + "' ended early (SDL says \"" + std::string(SDL_GetError()) + "\").");
+		}
+		to_mono(raw.data(), want, channels, format, out);
+		frames_read += want;
+		return want;
+	};
+
+	if (!resampler) return read_frames(count, data);
+
+	while (true) {
+		uint32_t got = resampler->pull(data, count);
+		if (got != 0 || resampler->finished) return got;
+		mono.resize(std::max< uint32_t >(count, 1024));
+		uint32_t frames = read_frames(uint32_t(mono.size()), mono.data());
+		if (frames == 0) resampler->finish();
+		else resampler->push(mono.data(), frames);
+	}
+}
+
+void WavStreamReader::rewind() {
+	if (SDL_RWseek(rw, Sint64(data_offset), RW_SEEK_SET) < 0) {
+		throw std::runtime_error("Failed to rewind WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
 	}
-	std::cout << "Range: " << min << ", " << max << std::endl;
+	frames_read = 0;
+	if (resampler) resampler->reset();
 }
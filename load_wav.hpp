@@ -2,6 +2,36 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <cstdint>
 
 //Load a WAV file as 48kHz floating-point mono; throws on error:
-void load_wav(std::string const &filename, std::vector< float > *data);
+// (*source_bits, if given, gets the bits per sample in the file -- e.g. to choose how to store it)
+void load_wav(std::string const &filename, std::vector< float > *data, uint32_t *source_bits = nullptr);
+
+//Incrementally read a WAV file as 48kHz floating-point mono (e.g., for streaming music);
+// the constructor and read() throw on error:
+struct SDL_RWops;
+struct StreamResampler;
+struct WavStreamReader {
+	WavStreamReader(std::string const &filename);
+	~WavStreamReader();
+	WavStreamReader(WavStreamReader const &) = delete;
+
+	//convert up to 'count' samples into 'data'; returns the number converted (0 at end of file):
+	uint32_t read(float *data, uint32_t count);
+	//go back to the start of the file:
+	void rewind();
+
+	std::string filename;
+	SDL_RWops *rw = nullptr;
+	uint16_t format = 0; //(as an SDL_AudioFormat)
+	uint32_t channels = 0;
+	uint32_t rate = 0;
+	uint64_t data_offset = 0; //file position of the first frame
+	uint32_t data_frames = 0; //frames in the file
+	uint32_t frames_read = 0; //frames read so far
+	std::vector< uint8_t > raw; //scratch space for file bytes
+	std::vector< float > mono; //scratch space for (pre-resampling) samples
+	std::unique_ptr< StreamResampler > resampler; //(only if rate isn't 48kHz)
+};
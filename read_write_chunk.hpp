@@ -4,6 +4,8 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
+#include <cstdint>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -63,3 +65,71 @@ void write_chunk(std::string const &magic, std::vector< T > const &from, std::os
 	to.write(reinterpret_cast< const char * >(&header), sizeof(header));
 	to.write(reinterpret_cast< const char * >(from.data()), from.size() * sizeof(T));
 }
+
+
+//helper function that finds a chunk (in the same format as read_chunk) in an in-memory buffer:
+// on success, *offset is advanced past the chunk, *bytes is set to the size of the chunk data,
+// and the returned pointer references the chunk data in-place
+inline char *find_chunk(std::vector< char > &from, std::string const &magic, size_t element_size, size_t *offset_, size_t *bytes_) {
+	assert(offset_);
+	auto &offset = *offset_;
+	assert(bytes_);
+	auto &bytes = *bytes_;
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (offset + sizeof(header) > from.size()) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(&header, from.data() + offset, sizeof(header));
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (header.size % element_size != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	if (offset + sizeof(header) + header.size > from.size()) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+
+	char *data = from.data() + offset + sizeof(header);
+	offset += sizeof(header) + header.size;
+	bytes = header.size;
+	return data;
+}
+
+//helper function that views a chunk in an in-memory buffer without copying:
+// (*count is set to the number of TT structures; throws if the data isn't aligned for T --
+//  chunks only stay aligned if every chunk before them is a multiple of alignof(T) in size)
+template< typename T >
+T *view_chunk(std::vector< char > &from, std::string const &magic, size_t *offset, size_t *count_) {
+	assert(count_);
+	auto &count = *count_;
+
+	size_t bytes = 0;
+	char *data = find_chunk(from, magic, sizeof(T), offset, &bytes);
+	if (reinterpret_cast< uintptr_t >(data) % alignof(T) != 0) {
+		throw std::runtime_error("Chunk data is not aligned for in-place access.");
+	}
+
+	count = bytes / sizeof(T);
+	return reinterpret_cast< T * >(data);
+}
+
+//helper function that copies a chunk out of an in-memory buffer (for chunks that may not be aligned):
+template< typename T >
+void copy_chunk(std::vector< char > &from, std::string const &magic, size_t *offset, std::vector< T > *to_) {
+	assert(to_);
+	auto &to = *to_;
+
+	size_t bytes = 0;
+	char const *data = find_chunk(from, magic, sizeof(T), offset, &bytes);
+	to.resize(bytes / sizeof(T));
+	if (bytes) std::memcpy(to.data(), data, bytes);
+}
@@ -0,0 +1,224 @@
+#include "resample.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLE_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+//filter parameters:
+static constexpr uint32_t ZeroCrossings = 16; //on each side of the center, at the lower of the two rates
+static constexpr uint32_t MaxPhases = 512; //rate ratios needing more phases round to the nearest of this many
+static constexpr double KaiserBeta = 8.0; //about -80dB stopband
+static constexpr double Passband = 0.92; //cutoff, as a fraction of the lower Nyquist frequency
+static constexpr size_t SamplesPerThread = 1 << 18; //don't bother with threads for less output than this
+
+//helper: zeroth-order modified Bessel function of the first kind (for the Kaiser window):
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (uint32_t k = 1; k < 64; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+//helper: dot product of 'count' (a multiple of four) floats:
+static inline float dot(float const *a, float const *b, uint32_t count) {
+#ifdef RESAMPLE_USE_SSE
+	__m128 sum = _mm_setzero_ps();
+	for (uint32_t i = 0; i < count; i += 4) {
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	}
+	//horizontal add:
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+#else
+	float sum = 0.0f;
+	for (uint32_t i = 0; i < count; ++i) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+#endif
+}
+
+//helper: the polyphase filter for converting in_rate to out_rate:
+struct ResampleFilter {
+	//output sample n is at input position n * step / phases (in lowest terms):
+	uint64_t phases = 1;
+	uint64_t step = 1;
+	uint32_t table_phases = 1;
+	uint32_t half = 0; //taps on each side of the center
+	uint32_t taps = 0; //per phase (a multiple of four, for the dot product)
+	std::vector< float > table; //taps for each phase
+
+	ResampleFilter(uint32_t in_rate, uint32_t out_rate);
+
+	//output sample n, from zero-padded input where padded[half + i] is in[i]:
+	float at(float const *padded, uint64_t n) const {
+		size_t i;
+		uint32_t p;
+		locate(n, &i, &p);
+		//the first tap (in[i - (half - 1)]) is at padded[i + 1]:
+		return apply(padded + i + 1, p);
+	}
+
+	//filter 'taps' samples starting at 'first' with phase p:
+	float apply(float const *first, uint32_t p) const {
+		return dot(first, table.data() + size_t(p) * taps, taps);
+	}
+
+	//input sample (i) and table phase (p) of output sample n:
+	void locate(uint64_t n, size_t *i_, uint32_t *p_) const {
+		uint64_t position = n * step;
+		size_t i = size_t(position / phases);
+		uint64_t phase = position % phases;
+		uint32_t p = uint32_t(table_phases == phases ? phase : (phase * table_phases + phases / 2) / phases);
+		if (p == table_phases) { //(rounded up to the next input sample)
+			p = 0;
+			i += 1;
+		}
+		*i_ = i;
+		*p_ = p;
+	}
+};
+
+ResampleFilter::ResampleFilter(uint32_t in_rate, uint32_t out_rate) {
+	if (in_rate == 0 || out_rate == 0) {
+		throw std::runtime_error("Can't resample from " + std::to_string(in_rate) + " Hz to " + std::to_string(out_rate) + " Hz.");
+	}
+
+	uint32_t g = std::gcd(in_rate, out_rate);
+	phases = out_rate / g;
+	step = in_rate / g;
+	table_phases = uint32_t(std::min< uint64_t >(phases, MaxPhases));
+
+	//filter: taps are spaced one input sample apart; widen when downsampling so the cutoff can drop:
+	double ratio = std::min(1.0, double(out_rate) / double(in_rate));
+	half = uint32_t(std::ceil(ZeroCrossings / ratio));
+	taps = (2 * half + 3) & ~3U; //(rounded up to a multiple of four for the dot product)
+	double cutoff = 0.5 * ratio * Passband; //cycles per input sample
+
+	//table of taps for each phase; phase p covers input positions (i - (half - 1) + k) for fractional offset p / table_phases:
+	table.resize(size_t(table_phases) * taps);
+	for (uint32_t p = 0; p < table_phases; ++p) {
+		double frac = double(p) / double(table_phases);
+		float *h = table.data() + size_t(p) * taps;
+		double sum = 0.0;
+		for (uint32_t k = 0; k < taps; ++k) {
+			double t = double(k) - double(half - 1) - frac; //distance (in input samples) from the output position
+			double x = 2.0 * cutoff * t;
+			double sinc = (x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x));
+			double w = t / double(half + 1); //window spans the taps (and a bit)
+			double window = (std::abs(w) >= 1.0 ? 0.0 : bessel_i0(KaiserBeta * std::sqrt(1.0 - w * w)) / bessel_i0(KaiserBeta));
+			h[k] = float(sinc * window);
+			sum += h[k];
+		}
+		//unity gain at DC:
+		for (uint32_t k = 0; k < taps; ++k) {
+			h[k] = float(h[k] / sum);
+		}
+	}
+}
+
+void resample(std::vector< float > const &in, uint32_t in_rate, uint32_t out_rate, std::vector< float > *out_) {
+	assert(out_);
+	auto &out = *out_;
+	if (in_rate == out_rate && in_rate != 0) {
+		out = in;
+		return;
+	}
+	ResampleFilter filter(in_rate, out_rate);
+
+	//zero-padded copy of the input so the filter never reads out of bounds:
+	std::vector< float > padded(size_t(filter.half) + in.size() + filter.taps, 0.0f);
+	std::copy(in.begin(), in.end(), padded.begin() + filter.half);
+
+	size_t count = size_t((uint64_t(in.size()) * filter.phases + filter.step - 1) / filter.step);
+	out.assign(count, 0.0f);
+
+	auto run = [&](size_t begin, size_t end) {
+		for (size_t n = begin; n < end; ++n) {
+			out[n] = filter.at(padded.data(), n);
+		}
+	};
+
+	uint32_t threads = uint32_t(std::min< size_t >(std::max(1U, std::thread::hardware_concurrency()), count / SamplesPerThread + 1));
+	if (threads <= 1) {
+		run(0, count);
+	} else {
+		std::vector< std::thread > workers;
+		size_t chunk = (count + threads - 1) / threads;
+		for (uint32_t t = 1; t < threads; ++t) {
+			workers.emplace_back(run, std::min(count, t * chunk), std::min(count, (t + 1) * chunk));
+		}
+		run(0, std::min(count, chunk));
+		for (auto &worker : workers) {
+			worker.join();
+		}
+	}
+}
+
+//------------ streaming ------------
+
+StreamResampler::StreamResampler(uint32_t in_rate, uint32_t out_rate) : filter(std::make_unique< ResampleFilter >(in_rate, out_rate)) {
+	reset();
+}
+
+StreamResampler::~StreamResampler() = default;
+
+void StreamResampler::reset() {
+	window.assign(filter->half, 0.0f); //(the zero padding before the first input sample)
+	base = 0;
+	input = 0;
+	produced = 0;
+	finished = false;
+}
+
+void StreamResampler::push(float const *in, uint32_t count) {
+	assert(!finished);
+	window.insert(window.end(), in, in + count);
+	input += count;
+}
+
+void StreamResampler::finish() {
+	if (finished) return;
+	window.insert(window.end(), filter->taps, 0.0f); //(the zero padding after the last input sample)
+	finished = true;
+}
+
+uint32_t StreamResampler::pull(float *out, uint32_t count) {
+	assert(out);
+	//(same output count as resample() gives for the whole input)
+	uint64_t total = (input * filter->phases + filter->step - 1) / filter->step;
+	uint32_t written = 0;
+	while (written < count && (!finished || produced < total)) {
+		size_t i;
+		uint32_t p;
+		filter->locate(produced, &i, &p);
+		if (i + filter->taps + 1 > base + window.size()) break; //needs input that hasn't arrived yet
+		out[written++] = filter->apply(window.data() + (i + 1 - base), p);
+		++produced;
+	}
+
+	//drop input that no later output needs (in big steps, so it isn't shuffled on every call):
+	size_t i;
+	uint32_t p;
+	filter->locate(produced, &i, &p);
+	if (i + 1 > base + 4096) {
+		size_t drop = std::min(window.size(), size_t(i + 1 - base));
+		window.erase(window.begin(), window.begin() + drop);
+		base += drop;
+	}
+	return written;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+//Convert mono audio 'in' (at 'in_rate' Hz) to 'out_rate' Hz with a Kaiser-windowed sinc polyphase filter
+// (band-limited to the lower of the two Nyquist frequencies); long inputs are split over worker threads:
+void resample(std::vector< float > const &in, uint32_t in_rate, uint32_t out_rate, std::vector< float > *out);
+
+//Incremental version of resample() for audio that arrives a block at a time (e.g., a file being streamed);
+// gives the same output as resample() on the whole input:
+struct ResampleFilter;
+struct StreamResampler {
+	StreamResampler(uint32_t in_rate, uint32_t out_rate);
+	~StreamResampler();
+	StreamResampler(StreamResampler const &) = delete;
+
+	//add 'count' input samples:
+	void push(float const *in, uint32_t count);
+	//no more input is coming (lets the last outputs through):
+	void finish();
+	//write up to 'count' output samples to 'out'; returns how many were ready:
+	uint32_t pull(float *out, uint32_t count);
+	//forget all input (e.g., to start the stream over):
+	void reset();
+
+	//internals:
+	std::unique_ptr< ResampleFilter > filter;
+	std::vector< float > window; //zero-padded input, from padded index 'base' on
+	uint64_t base = 0;
+	uint64_t input = 0; //samples pushed
+	uint64_t produced = 0; //samples pulled
+	bool finished = false;
+};
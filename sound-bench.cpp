@@ -0,0 +1,100 @@
+#include "Sound.hpp"
+
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <string>
+#include <cmath>
+
+//This file times Sound::mix with many simultaneous voices (no audio device needed),
+// and checks the mixing kernel against a one-sample-at-a-time reference loop.
+//usage: sound-bench [voice count] [block count] [voice limit]
+// (the voice limit defaults to the voice count, so every voice is mixed; pass a lower one to time voice management)
+
+int main(int argc, char **argv) {
+	uint32_t voice_count = (argc > 1 ? uint32_t(std::stoul(argv[1])) : 64);
+	uint32_t block_count = (argc > 2 ? uint32_t(std::stoul(argv[2])) : 2000);
+	uint32_t voice_limit = (argc > 3 ? uint32_t(std::stoul(argv[3])) : voice_count);
+	Sound::set_max_voices(voice_limit);
+
+	//a few noise bursts of different (odd) lengths, so loops wrap mid-block:
+	std::mt19937 mt(0x31415926);
+	std::uniform_real_distribution< float > noise(-1.0f, 1.0f);
+	std::vector< Sound::Sample > samples;
+	for (uint32_t length : {4801U, 11025U, 30011U, 48000U}) {
+		std::vector< float > data(length);
+		for (auto &d : data) d = noise(mt);
+		samples.emplace_back(data);
+	}
+
+	typedef std::chrono::high_resolution_clock Clock;
+	auto ms = [](Clock::time_point a, Clock::time_point b) {
+		return std::chrono::duration< double, std::milli >(b - a).count();
+	};
+
+	//---- kernel vs. reference ----
+	uint32_t mismatches = 0;
+	{
+		std::vector< float > const &data = samples.back().data;
+		std::vector< float > kernel(2 * Sound::MIX_SAMPLES), reference(2 * Sound::MIX_SAMPLES);
+		double kernel_ms = 0.0, reference_ms = 0.0;
+		for (uint32_t b = 0; b < block_count; ++b) {
+			uint32_t offset = b % (uint32_t(data.size()) - Sound::MIX_SAMPLES);
+			uint32_t count = Sound::MIX_SAMPLES - (b % 13); //(exercise the leftover frames too)
+			glm::vec2 pan(0.5f, 0.25f);
+			glm::vec2 pan_step(-0.0003f, 0.0002f);
+
+			auto before = Clock::now();
+			for (uint32_t k = 0; k < count; ++k) {
+				reference[2 * k + 0] += (pan.x + float(k) * pan_step.x) * data[offset + k];
+				reference[2 * k + 1] += (pan.y + float(k) * pan_step.y) * data[offset + k];
+			}
+			auto after = Clock::now();
+			reference_ms += ms(before, after);
+
+			before = Clock::now();
+			Sound::mix_run(data.data() + offset, count, pan, pan_step, kernel.data());
+			after = Clock::now();
+			kernel_ms += ms(before, after);
+		}
+		for (uint32_t i = 0; i < kernel.size(); ++i) {
+			if (std::abs(kernel[i] - reference[i]) > 1e-3f * (1.0f + std::abs(reference[i]))) ++mismatches;
+		}
+		std::cout << "mix_run: reference " << reference_ms << " ms, kernel " << kernel_ms << " ms (" << (reference_ms / kernel_ms) << "x) for " << block_count << " blocks" << std::endl;
+	}
+
+	//---- full mix ----
+	std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+	std::vector< Sound::PlayingHandle > voices;
+	for (uint32_t v = 0; v < voice_count; ++v) {
+		Sound::Sample const &sample = samples[v % samples.size()];
+		if (v % 2) {
+			voices.emplace_back(Sound::loop(sample, 1.0f / voice_count, unit(mt)));
+		} else {
+			voices.emplace_back(Sound::loop_3D(sample, 1.0f / voice_count, 10.0f * glm::vec3(unit(mt), unit(mt), unit(mt)), 5.0f));
+		}
+	}
+
+	std::vector< float > buffer(2 * Sound::MIX_SAMPLES);
+	float peak = 0.0f;
+	auto before = Clock::now();
+	for (uint32_t b = 0; b < block_count; ++b) {
+		//keep the ramps busy, as a game would:
+		if (b % 4 == 0) {
+			for (uint32_t v = 1; v < voices.size(); v += 2) voices[v].set_pan(unit(mt));
+		}
+		Sound::mix(buffer.data());
+		peak = std::max(peak, std::abs(buffer[b % buffer.size()]));
+	}
+	auto after = Clock::now();
+	double mix_ms = ms(before, after);
+	double block_ms = 1000.0 * Sound::MIX_SAMPLES / Sound::AUDIO_RATE;
+	std::cout << voice_count << " voices (" << Sound::real_voice_count << " real, " << Sound::virtual_voice_count << " virtual): " << (mix_ms / block_count) << " ms per " << Sound::MIX_SAMPLES << "-sample block ("
+		<< (100.0 * mix_ms / block_count / block_ms) << "% of real time; peak " << peak << ")" << std::endl;
+
+	if (mismatches) {
+		std::cerr << "ERROR: " << mismatches << " results differ between reference and kernel." << std::endl;
+		return 1;
+	}
+	return 0;
+}
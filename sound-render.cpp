@@ -0,0 +1,236 @@
+#include "Sound.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+//This file renders a scripted sequence of Sound calls offline (no audio device) to a WAV file,
+// and reports how long each block took to mix -- e.g. for benchmarking or diffing mixer output in CI.
+//usage: sound-render <script> <output.wav> [block-times.csv]
+//
+//Script format: one command per line, each starting with a time in seconds ('#' starts a comment).
+// Commands take effect at the first block starting at or after their time; lines must be in time order.
+// Sample files are relative to the script's directory.
+//  <t> sample <name> <file> [float|int16|adpcm]          -- load a sample (default: automatic format)
+//  <t> stream <name> <file.opus>                         -- make a streaming sample
+//  <t> play <sample> <voice> [volume [pan]]              -- (also: loop)
+//  <t> play_3D <sample> <voice> <volume> <x> <y> <z> [half_volume_radius]   -- (also: loop_3D)
+//  <t> volume <voice> <volume> [ramp]
+//  <t> pan <voice> <pan> [ramp]
+//  <t> position <voice> <x> <y> <z> [ramp]
+//  <t> stop <voice> [ramp]
+//  <t> stop_all
+//  <t> listener <x> <y> <z> <right x> <right y> <right z> [ramp]
+//  <t> master <volume> [ramp]
+//  <t> end                                               -- stop rendering (required)
+
+//helper: write interleaved stereo float samples as a 32-bit float WAV file:
+static void save_wav(std::string const &filename, std::vector< float > const &data) {
+	std::ofstream out(filename, std::ios::binary);
+	auto u32 = [&](uint32_t v) { out.write(reinterpret_cast< char const * >(&v), 4); };
+	auto u16 = [&](uint16_t v) { out.write(reinterpret_cast< char const * >(&v), 2); };
+	uint32_t data_bytes = uint32_t(data.size() * sizeof(float));
+
+	out.write("RIFF", 4); u32(4 + (8 + 16) + (8 + data_bytes));
+	out.write("WAVE", 4);
+	out.write("fmt ", 4); u32(16);
+	u16(3); //IEEE float
+	u16(2); //channels
+	u32(Sound::AUDIO_RATE);
+	u32(Sound::AUDIO_RATE * 2 * sizeof(float)); //bytes per second
+	u16(2 * sizeof(float)); //bytes per frame
+	u16(32); //bits per sample
+	out.write("data", 4); u32(data_bytes);
+	out.write(reinterpret_cast< char const * >(data.data()), data_bytes);
+	if (!out) {
+		throw std::runtime_error("Failed to write '" + filename + "'.");
+	}
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+	if (argc != 3 && argc != 4) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <script> <output.wav> [block-times.csv]" << std::endl;
+		return 1;
+	}
+	std::string script_file = argv[1];
+	std::string wav_file = argv[2];
+	std::string times_file = (argc > 3 ? argv[3] : "");
+
+	std::string base = script_file.substr(0, script_file.find_last_of("/\\") + 1);
+	auto resolve = [&](std::string const &path) {
+		if (!path.empty() && (path[0] == '/' || path[0] == '\\')) return path;
+		return base + path;
+	};
+
+	//named samples / voices referenced by the script:
+	std::map< std::string, std::unique_ptr< Sound::Sample > > samples;
+	std::map< std::string, std::unique_ptr< Sound::StreamingSample > > streams;
+	std::map< std::string, Sound::PlayingHandle > voices;
+
+	std::vector< float > output;
+	std::vector< float > block_seconds;
+	auto render_until = [&](float time) {
+		uint32_t blocks = uint32_t(std::ceil(time * Sound::AUDIO_RATE / Sound::MIX_SAMPLES));
+		uint32_t done = uint32_t(block_seconds.size());
+		if (blocks <= done) return;
+		output.resize(size_t(blocks) * 2 * Sound::MIX_SAMPLES);
+		block_seconds.resize(blocks);
+		Sound::render(blocks - done, output.data() + size_t(done) * 2 * Sound::MIX_SAMPLES, block_seconds.data() + done);
+		Sound::update(); //(as the game does each frame)
+	};
+
+	std::ifstream script(script_file);
+	if (!script) {
+		throw std::runtime_error("Failed to open script '" + script_file + "'.");
+	}
+	bool ended = false;
+	float last_time = 0.0f;
+	std::string line;
+	for (uint32_t line_number = 1; !ended && std::getline(script, line); ++line_number) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream in(line);
+		float time;
+		std::string command;
+		if (!(in >> time)) continue; //(blank line)
+		auto error = [&](std::string const &message) {
+			return std::runtime_error(script_file + ":" + std::to_string(line_number) + ": " + message);
+		};
+		if (!(in >> command)) throw error("expected a command after the time.");
+		if (time < last_time) throw error("commands must be in time order.");
+		last_time = time;
+
+		render_until(time);
+
+		auto voice = [&]() -> Sound::PlayingHandle {
+			std::string name;
+			if (!(in >> name) || !voices.count(name)) throw error("expected a voice name.");
+			return voices[name];
+		};
+		auto optional = [&](float fallback) {
+			float value;
+			return (in >> value) ? value : fallback;
+		};
+		constexpr float Ramp = 1.0f / 60.0f; //(default ramp, as in Sound.hpp)
+
+		if (command == "sample") {
+			std::string name, file, format;
+			if (!(in >> name >> file)) throw error("expected: sample <name> <file> [format]");
+			in >> format;
+			Sound::Sample::Format f = Sound::Sample::Auto;
+			if (format == "float") f = Sound::Sample::Float;
+			else if (format == "int16") f = Sound::Sample::Int16;
+			else if (format == "adpcm") f = Sound::Sample::ADPCM;
+			else if (format != "") throw error("unknown sample format '" + format + "'.");
+			samples[name] = std::make_unique< Sound::Sample >(resolve(file), f);
+		} else if (command == "stream") {
+			std::string name, file;
+			if (!(in >> name >> file)) throw error("expected: stream <name> <file.opus>");
+			streams[name] = std::make_unique< Sound::StreamingSample >(resolve(file));
+		} else if (command == "play" || command == "loop") {
+			std::string sample, name;
+			if (!(in >> sample >> name)) throw error("expected: " + command + " <sample> <voice> [volume [pan]]");
+			float volume = optional(1.0f);
+			float pan = optional(0.0f);
+			bool loop = (command == "loop");
+			if (samples.count(sample)) {
+				voices[name] = (loop ? Sound::loop(*samples[sample], volume, pan) : Sound::play(*samples[sample], volume, pan));
+			} else if (streams.count(sample)) {
+				voices[name] = (loop ? Sound::loop(*streams[sample], volume, pan) : Sound::play(*streams[sample], volume, pan));
+			} else {
+				throw error("unknown sample '" + sample + "'.");
+			}
+		} else if (command == "play_3D" || command == "loop_3D") {
+			std::string sample, name;
+			float volume;
+			glm::vec3 position;
+			if (!(in >> sample >> name >> volume >> position.x >> position.y >> position.z)) throw error("expected: " + command + " <sample> <voice> <volume> <x> <y> <z> [half_volume_radius]");
+			if (!samples.count(sample)) throw error("unknown sample '" + sample + "'.");
+			float radius = optional(std::numeric_limits< float >::infinity());
+			voices[name] = (command == "loop_3D"
+				? Sound::loop_3D(*samples[sample], volume, position, radius)
+				: Sound::play_3D(*samples[sample], volume, position, radius));
+		} else if (command == "volume") {
+			Sound::PlayingHandle v = voice();
+			float volume;
+			if (!(in >> volume)) throw error("expected: volume <voice> <volume> [ramp]");
+			v.set_volume(volume, optional(Ramp));
+		} else if (command == "pan") {
+			Sound::PlayingHandle v = voice();
+			float pan;
+			if (!(in >> pan)) throw error("expected: pan <voice> <pan> [ramp]");
+			v.set_pan(pan, optional(Ramp));
+		} else if (command == "position") {
+			Sound::PlayingHandle v = voice();
+			glm::vec3 position;
+			if (!(in >> position.x >> position.y >> position.z)) throw error("expected: position <voice> <x> <y> <z> [ramp]");
+			v.set_position(position, optional(Ramp));
+		} else if (command == "stop") {
+			Sound::PlayingHandle v = voice();
+			v.stop(optional(Ramp));
+		} else if (command == "stop_all") {
+			Sound::stop_all_samples();
+		} else if (command == "listener") {
+			glm::vec3 position, right;
+			if (!(in >> position.x >> position.y >> position.z >> right.x >> right.y >> right.z)) throw error("expected: listener <x> <y> <z> <right x> <right y> <right z> [ramp]");
+			Sound::listener.set_position_right(position, right, optional(Ramp));
+		} else if (command == "master") {
+			float volume;
+			if (!(in >> volume)) throw error("expected: master <volume> [ramp]");
+			Sound::set_volume(volume, optional(Ramp));
+		} else if (command == "end") {
+			ended = true;
+		} else {
+			throw error("unknown command '" + command + "'.");
+		}
+	}
+	if (!ended) {
+		throw std::runtime_error(script_file + ": missing 'end' command.");
+	}
+
+	save_wav(wav_file, output);
+	std::cout << "Wrote " << block_seconds.size() << " blocks (" << (float(block_seconds.size()) * Sound::MIX_SAMPLES / Sound::AUDIO_RATE) << " seconds) to '" << wav_file << "'." << std::endl;
+
+	//per-block mix times:
+	if (!block_seconds.empty()) {
+		std::vector< float > sorted = block_seconds;
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0.0;
+		for (float t : sorted) total += t;
+		float budget = float(Sound::MIX_SAMPLES) / float(Sound::AUDIO_RATE);
+		std::cout << "Mix time per block (ms): mean " << (1000.0 * total / sorted.size())
+			<< ", median " << (1000.0f * sorted[sorted.size() / 2])
+			<< ", 99th percentile " << (1000.0f * sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)])
+			<< ", max " << (1000.0f * sorted.back())
+			<< " (budget " << (1000.0f * budget) << ")" << std::endl;
+	}
+	if (times_file != "") {
+		std::ofstream times(times_file);
+		times << "block,seconds\n";
+		for (uint32_t b = 0; b < block_seconds.size(); ++b) {
+			times << b << "," << block_seconds[b] << "\n";
+		}
+	}
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
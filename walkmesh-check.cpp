@@ -0,0 +1,55 @@
+#include "WalkMesh.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//This file loads walkmesh files the way the game does and reports any that fail,
+// e.g. to catch layout problems in exported data before the game trips over them at startup.
+//usage: walkmesh-check [file.w or directory ...]   (default: every .w file in 'dist')
+
+int main(int argc, char **argv) {
+	std::vector< std::string > args(argv + 1, argv + argc);
+	if (args.empty()) args.emplace_back("dist");
+
+	std::vector< std::string > files;
+	for (auto const &arg : args) {
+		if (std::filesystem::is_directory(arg)) {
+			std::vector< std::string > found;
+			for (auto const &entry : std::filesystem::directory_iterator(arg)) {
+				if (entry.path().extension() == ".w") found.emplace_back(entry.path().string());
+			}
+			std::sort(found.begin(), found.end());
+			files.insert(files.end(), found.begin(), found.end());
+		} else {
+			files.emplace_back(arg);
+		}
+	}
+	if (files.empty()) {
+		std::cerr << "No walkmesh files found." << std::endl;
+		return 1;
+	}
+
+	uint32_t failed = 0;
+	for (auto const &file : files) {
+		try {
+			WalkMeshes walkmeshes(file);
+			size_t triangles = 0;
+			for (auto const &[name, mesh] : walkmeshes.meshes) {
+				triangles += mesh.triangles.size();
+			}
+			std::cout << file << ": " << walkmeshes.meshes.size() << " meshes, " << triangles << " triangles" << std::endl;
+		} catch (std::exception const &e) {
+			std::cerr << file << ": FAILED: " << e.what() << std::endl;
+			++failed;
+		}
+	}
+
+	if (failed) {
+		std::cerr << "ERROR: " << failed << " of " << files.size() << " walkmesh files failed to load." << std::endl;
+		return 1;
+	}
+	return 0;
+}
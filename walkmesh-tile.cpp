@@ -0,0 +1,61 @@
+#include "TiledWalkMesh.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+//This file converts one walkmesh from a '.w' file into the tiled '.wt' format read by TiledWalkMesh.
+//usage: walkmesh-tile <in.w> <mesh name> <out.wt> [tile size]
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+	if (argc != 4 && argc != 5) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.w> <mesh name> <out.wt> [tile size]" << std::endl;
+		return 1;
+	}
+	std::string in_file = argv[1];
+	std::string mesh_name = argv[2];
+	std::string out_file = argv[3];
+	float tile_size = (argc > 4 ? std::stof(argv[4]) : 8.0f);
+	if (!(tile_size > 0.0f)) {
+		std::cerr << "Tile size must be positive." << std::endl;
+		return 1;
+	}
+
+	WalkMeshes walkmeshes(in_file);
+	WalkMesh const &mesh = walkmeshes.lookup(mesh_name);
+
+	{
+		std::ofstream out(out_file, std::ios::binary);
+		TiledWalkMesh::write(mesh, tile_size, &out);
+		if (!out) {
+			throw std::runtime_error("Failed to write '" + out_file + "'.");
+		}
+	}
+
+	//read it back, so a broken file never gets shipped:
+	TiledWalkMesh tiled(out_file);
+	size_t triangles = 0;
+	for (auto const &tile : tiled.tiles) {
+		triangles += tile.triangle_end - tile.triangle_begin;
+	}
+	if (triangles != mesh.triangles.size()) {
+		throw std::runtime_error("Tiled walkmesh '" + out_file + "' has " + std::to_string(triangles) + " triangles; expected " + std::to_string(mesh.triangles.size()) + ".");
+	}
+	std::cout << "Wrote '" << out_file << "': " << tiled.tiles.size() << " tiles, " << triangles << " triangles." << std::endl;
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}